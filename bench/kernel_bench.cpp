@@ -0,0 +1,197 @@
+/*
+*Microbenchmarks of the per-particle kernels, built without the Charm++ runtime
+*(make microbench). For every kernel, particle count and color mix it prints the
+*best time over the repetitions in ns/particle, and the bytes moved per particle:
+*the arrays read and written by the loop, or the packed size for pup.
+*
+*usage: ./kernel_bench [max particles] [repetitions]
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <chrono>
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "pup_stl.h"
+#include "particle.h"
+#include "particle_array.h"
+#include "particle_kernels.h"
+#include "perturb_kernel.h"
+
+using namespace std;
+
+static const int velocityFactor = 5;
+static const int numCellsPerDim = 100;
+static const double cellDim = 1.0;
+
+// the benchmarked cell
+static const int cellX = 42, cellY = 17;
+
+struct Result {
+  double nsPerParticle;
+  double bytesPerParticle;
+};
+
+// Fill n particles of cell (cellX, cellY); mix is "red", "green" or "mixed"
+static void makeParticles(ParticleArray &particles, int n, const string &mix, unsigned seed) {
+  mt19937 gen(seed);
+  uniform_real_distribution<double> unit(0.0, 1.0);
+  const char colors[3] = { 'r', 'g', 'b' };
+
+  particles.clear();
+  for(int i=0; i<n; i++) {
+    char c = mix == "red" ? 'r' : mix == "green" ? 'g' : colors[gen() % 3];
+    particles.push_back(Particle((cellX + unit(gen)) * cellDim, (cellY + unit(gen)) * cellDim, c, i + 1));
+  }
+
+  // shuffle the gids, as after a few steps of migration
+  shuffle(particles.gid.begin(), particles.gid.end(), gen);
+}
+
+template<class Setup, class Kernel>
+static double bestSeconds(int repetitions, Setup setup, Kernel kernel) {
+  double best = 1e30;
+  for(int r=0; r<repetitions; r++) {
+    setup();
+    auto start = chrono::steady_clock::now();
+    kernel();
+    auto end = chrono::steady_clock::now();
+    best = min(best, chrono::duration<double>(end - start).count());
+  }
+  return best;
+}
+
+static Result benchPerturb(const ParticleArray &input, int mode, int repetitions) {
+  ParticleArray particles;
+  int n = input.size();
+  double seconds = bestSeconds(repetitions,
+    [&]() { particles = input; },
+    [&]() { perturbParticles(particles.x.data(), particles.y.data(), particles.color.data(), n, velocityFactor, mode); });
+  // reads x, y, color and writes x, y
+  Result r = { seconds * 1e9 / n, (double) (4*sizeof(double) + sizeof(char)) };
+  return r;
+}
+
+static Result benchPartition(const ParticleArray &input, int repetitions) {
+  ParticleArray particles, moved = input, outgoing[8];
+  int n = input.size();
+
+  // one perturbation step decides which particles leave the cell
+  perturbParticles(moved.x.data(), moved.y.data(), moved.color.data(), n, velocityFactor, PERTURB_EXACT);
+  double startX = cellX * cellDim, startY = cellY * cellDim;
+
+  double seconds = bestSeconds(repetitions,
+    [&]() {
+      particles = moved;
+      for(int i=0; i<8; i++)
+        outgoing[i].clear();
+    },
+    [&]() { partitionParticles(particles, startX, startX + cellDim, startY, startY + cellDim, outgoing); });
+
+  // reads x, y; every leaver is copied out and replaced by the tail particle
+  int numLeavers = n - particles.size();
+  double particleBytes = 2*sizeof(double) + sizeof(int) + sizeof(char);
+  Result r = { seconds * 1e9 / n, 2*sizeof(double) + 2*particleBytes*numLeavers/n };
+  return r;
+}
+
+static Result benchWrap(const ParticleArray &input, int repetitions) {
+  ParticleArray particles;
+  int n = input.size();
+  double boxMax = numCellsPerDim * cellDim;
+
+  // particles arriving in cell (0, 0) across the upper edges of the box
+  ParticleArray incoming = input;
+  for(int i=0; i<n; i++) {
+    if(i % 2) incoming.x[i] += boxMax;
+    if(i % 3) incoming.y[i] += boxMax;
+  }
+
+  double seconds = bestSeconds(repetitions,
+    [&]() { particles = incoming; },
+    [&]() { wrapIncoming(particles.x.data(), particles.y.data(), 0, n, 0, 0, numCellsPerDim, 0.0, boxMax); });
+  Result r = { seconds * 1e9 / n, (double) (4*sizeof(double)) };
+  return r;
+}
+
+// Pack a vector<Particle>, as held by a cell after the reorganization
+static Result benchPupParticles(const ParticleArray &input, int repetitions) {
+  int n = input.size();
+  vector<Particle> particles(n);
+  for(int i=0; i<n; i++)
+    particles[i] = input.get(i);
+
+  PUP::sizer sizer;
+  sizer | particles;
+  vector<char> buffer(sizer.size());
+
+  double seconds = bestSeconds(repetitions,
+    [&]() {},
+    [&]() { PUP::toMem packer(buffer.data()); packer | particles; });
+  Result r = { seconds * 1e9 / n, (double) sizer.size() / n };
+  return r;
+}
+
+// Pack a ParticleArray, as done when a cell migrates
+static Result benchPupArray(const ParticleArray &input, int repetitions) {
+  ParticleArray particles = input;
+  int n = input.size();
+
+  PUP::sizer sizer;
+  sizer | particles;
+  vector<char> buffer(sizer.size());
+
+  double seconds = bestSeconds(repetitions,
+    [&]() {},
+    [&]() { PUP::toMem packer(buffer.data()); packer | particles; });
+  Result r = { seconds * 1e9 / n, (double) sizer.size() / n };
+  return r;
+}
+
+// Group the particles by the cell owning their gid, as in reorganizeParticles. The gids of
+// a cell are shuffled over the whole grid, the worst case for the dense owner table.
+static Result benchBucket(const ParticleArray &input, int repetitions) {
+  vector<int> owners;
+  vector<ParticleArray> buckets;
+  int n = input.size();
+  int numCells = numCellsPerDim * numCellsPerDim;
+  int ppcEqualDist = max(1, n / numCells);
+  double seconds = bestSeconds(repetitions,
+    [&]() {},
+    [&]() { bucketByOwner(input, ppcEqualDist, numCells, owners, buckets); });
+  // reads gid in the range and counting passes, then copies every particle
+  double particleBytes = 2*sizeof(double) + sizeof(int) + sizeof(char);
+  Result r = { seconds * 1e9 / n, 2*sizeof(int) + 2*particleBytes };
+  return r;
+}
+
+static void print(const char *kernel, const string &mix, int n, Result r) {
+  printf("%-16s %-6s %9d %12.3f %12.2f\n", kernel, mix.c_str(), n, r.nsPerParticle, r.bytesPerParticle);
+}
+
+int main(int argc, char **argv) {
+  int maxParticles = argc > 1 ? atoi(argv[1]) : 1000000;
+  int repetitions = argc > 2 ? atoi(argv[2]) : 10;
+  const char *mixes[3] = { "red", "green", "mixed" };
+
+  printf("%-16s %-6s %9s %12s %12s\n", "kernel", "mix", "particles", "ns/particle", "bytes/part");
+  for(int n=1000; n<=maxParticles; n*=10) {
+    for(int m=0; m<3; m++) {
+      string mix(mixes[m]);
+      ParticleArray particles;
+      makeParticles(particles, n, mix, 1234 + n);
+
+      print("perturb-exact", mix, n, benchPerturb(particles, PERTURB_EXACT, repetitions));
+      print("perturb-fast", mix, n, benchPerturb(particles, PERTURB_FAST, repetitions));
+      print("partition", mix, n, benchPartition(particles, repetitions));
+      print("wrap", mix, n, benchWrap(particles, repetitions));
+      print("pup-particles", mix, n, benchPupParticles(particles, repetitions));
+      print("pup-array", mix, n, benchPupArray(particles, repetitions));
+      print("bucket-by-owner", mix, n, benchBucket(particles, repetitions));
+    }
+  }
+  return 0;
+}
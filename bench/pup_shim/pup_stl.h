@@ -0,0 +1,81 @@
+#ifndef BENCH_PUP_SHIM_H
+#define BENCH_PUP_SHIM_H
+
+/*
+*Minimal stand-in for the Charm++ PUP framework, enough to build particle.h and
+*particle_array.h without the runtime. Like the real one, arithmetic values and
+*vectors of them are copied as raw bytes, and vectors carry their length first.
+*/
+
+#include <stddef.h>
+#include <string.h>
+#include <type_traits>
+#include <vector>
+
+namespace PUP {
+
+class er {
+  protected:
+    bool unpacking;
+    er(bool unpacking) : unpacking(unpacking) {}
+
+  public:
+    virtual ~er() {}
+    virtual void bytes(void *data, size_t numBytes) = 0;
+    bool isUnpacking() const { return unpacking; }
+};
+
+// Counts the bytes a pup would move
+class sizer : public er {
+  size_t numBytes;
+
+  public:
+    sizer() : er(false), numBytes(0) {}
+    void bytes(void *data, size_t n) { numBytes += n; }
+    size_t size() const { return numBytes; }
+};
+
+class toMem : public er {
+  char *out;
+
+  public:
+    toMem(void *buffer) : er(false), out((char *) buffer) {}
+    void bytes(void *data, size_t n) { memcpy(out, data, n); out += n; }
+};
+
+class fromMem : public er {
+  const char *in;
+
+  public:
+    fromMem(const void *buffer) : er(true), in((const char *) buffer) {}
+    void bytes(void *data, size_t n) { memcpy(data, in, n); in += n; }
+};
+
+template<class T>
+inline typename std::enable_if<std::is_arithmetic<T>::value>::type operator|(er &p, T &t) {
+  p.bytes(&t, sizeof(T));
+}
+
+template<class T>
+inline typename std::enable_if<!std::is_arithmetic<T>::value>::type operator|(er &p, T &t) {
+  t.pup(p);
+}
+
+template<class T>
+inline void operator|(er &p, std::vector<T> &v) {
+  int n = v.size();
+  p | n;
+  if(p.isUnpacking())
+    v.resize(n);
+  if(std::is_arithmetic<T>::value) {
+    if(n > 0)
+      p.bytes(v.data(), n * sizeof(T));
+  } else {
+    for(int i=0; i<n; i++)
+      p | v[i];
+  }
+}
+
+}
+
+#endif
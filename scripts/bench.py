@@ -0,0 +1,136 @@
+#!/usr/bin/env python3
+"""Strong and weak scaling sweeps of the particle simulation.
+
+Runs ./particle through charmrun for every combination of the swept parameters
+and writes one CSV row per run:
+
+  series,pes,grid,ppc,velfact,lbfreq,iterations,total_time,time_per_step,
+  efficiency,migration_rate,total_particles,extra
+
+Strong scaling keeps the grid fixed while the PE count grows; weak scaling grows
+the grid with the PE count so that every PE keeps the same number of cells.
+Parallel efficiency is relative to the smallest PE count of the same series
+(T1*P1/(T*P) for strong, T1/T for weak). Runs pass --no-verify, since precomputed
+output only exists for two configurations (see scripts/compareOutput); --verify
+checks the final particles anyway. The migration rate is the mean number
+of particles leaving their cell per step over the total particle count, both
+taken from the reductions the simulation prints every few iterations.
+
+Example (multicore or netlrts build):
+  scripts/bench.py --pes 1,2,4,8 --grid 64 --ppc 100 --iterations 50 --out bench.csv
+"""
+
+import argparse
+import csv
+import math
+import re
+import subprocess
+import sys
+
+TIME_RE = re.compile(r"total time taken is ([0-9.eE+-]+) seconds")
+ITER_RE = re.compile(r"Iteration: (\d+), Outgoing Particles Sum: (\d+), Total Particles: (\d+)")
+
+FIELDS = ["series", "pes", "grid", "ppc", "velfact", "lbfreq", "iterations", "total_time",
+          "time_per_step", "efficiency", "migration_rate", "total_particles", "extra"]
+
+
+def int_list(text):
+    return [int(v) for v in text.split(",") if v]
+
+
+def run_once(args, pes, grid, ppc, velfact, lbfreq):
+    command = args.launcher.format(pes=pes).split() + [
+        str(ppc), str(grid), str(args.iterations), args.dist, str(velfact), "no", str(lbfreq)]
+    if not args.verify:
+        command.append("--no-verify")
+    command += args.extra.split()
+
+    result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.STDOUT,
+                            universal_newlines=True, timeout=args.timeout)
+    output = result.stdout
+    if result.returncode != 0:
+        sys.stderr.write(output)
+        raise RuntimeError("run failed: " + " ".join(command))
+
+    time_match = TIME_RE.search(output)
+    if time_match is None:
+        sys.stderr.write(output)
+        raise RuntimeError("no timing line in the output of: " + " ".join(command))
+    total_time = float(time_match.group(1))
+
+    # Outgoing sums are per reduction iteration; the rate averages them over the run
+    samples = [(int(out), int(total)) for _, out, total in ITER_RE.findall(output)]
+    total_particles = samples[-1][1] if samples else 0
+    migration_rate = 0.0
+    if samples and total_particles > 0:
+        migration_rate = sum(out for out, _ in samples) / float(len(samples) * total_particles)
+
+    return total_time, migration_rate, total_particles
+
+
+def sweep(args, series, writer):
+    pes_list = sorted(args.pes)
+    for grid0 in args.grid:
+        for ppc in args.ppc:
+            for velfact in args.velfact:
+                for lbfreq in args.lbfreq:
+                    base = None
+                    for pes in pes_list:
+                        if series == "weak":
+                            # Same number of cells per PE as the smallest run
+                            grid = max(1, int(round(grid0 * math.sqrt(float(pes) / pes_list[0]))))
+                        else:
+                            grid = grid0
+
+                        total_time, migration_rate, total_particles = run_once(args, pes, grid, ppc, velfact, lbfreq)
+                        if base is None:
+                            base = (pes, total_time)
+
+                        if series == "strong":
+                            efficiency = base[1] * base[0] / (total_time * pes)
+                        else:
+                            efficiency = base[1] / total_time
+
+                        writer.writerow({
+                            "series": series, "pes": pes, "grid": grid, "ppc": ppc,
+                            "velfact": velfact, "lbfreq": lbfreq, "iterations": args.iterations,
+                            "total_time": "%.6f" % total_time,
+                            "time_per_step": "%.6f" % (total_time / args.iterations),
+                            "efficiency": "%.4f" % efficiency,
+                            "migration_rate": "%.6f" % migration_rate,
+                            "total_particles": total_particles, "extra": args.extra})
+                        args.out_file.flush()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--series", choices=["strong", "weak", "both"], default="both")
+    parser.add_argument("--pes", type=int_list, default=[1, 2, 4], help="comma-separated PE counts")
+    parser.add_argument("--grid", type=int_list, default=[32], help="grid sizes (cells per dimension)")
+    parser.add_argument("--ppc", type=int_list, default=[100], help="particles per cell seed values")
+    parser.add_argument("--velfact", type=int_list, default=[5], help="velocity reduction factors")
+    parser.add_argument("--lbfreq", type=int_list, default=[5], help="load balancing frequencies")
+    parser.add_argument("--iterations", type=int, default=50)
+    parser.add_argument("--dist", default="1,2,3,10", help="particle distribution ratios")
+    parser.add_argument("--verify", action="store_true",
+                        help="compare the final particles with scripts/compareOutput (only grids 4 and 35 have output)")
+    parser.add_argument("--extra", default="", help="extra options passed to ./particle, e.g. \"--sparse\"")
+    parser.add_argument("--launcher", default="./charmrun +p{pes} ./particle ++local",
+                        help="command that starts the program on {pes} PEs")
+    parser.add_argument("--timeout", type=int, default=3600, help="seconds allowed per run")
+    parser.add_argument("--out", default="-", help="CSV file (default: stdout)")
+    args = parser.parse_args()
+
+    args.out_file = sys.stdout if args.out == "-" else open(args.out, "w", newline="")
+    writer = csv.DictWriter(args.out_file, fieldnames=FIELDS)
+    writer.writeheader()
+
+    for series in (["strong", "weak"] if args.series == "both" else [args.series]):
+        sweep(args, series, writer)
+
+    if args.out_file is not sys.stdout:
+        args.out_file.close()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,21 @@
+"""Layout of the binary particle file, shared by the conversion scripts.
+
+./particle ... --output-format binary writes particles.bin in this format, and
+binary golden files use it too. It must match ParticleFileHeader and
+ParticleRecord in src/particle_output.h.
+
+Layout (native byte order, little-endian on all supported platforms):
+  header: char magic[8] = "PARTBIN\\0", int32 version, int32 record size,
+          int32 cells per dimension, int32 reserved, int64 number of particles
+  record: double x, double y, int32 gid, char color, 3 padding bytes
+
+Records are ordered by gid. Cell (x, y) owns ppc = particles // cells^2 records
+starting at (x*cells + y)*ppc; the last cell also owns the remainder.
+"""
+
+import struct
+
+HEADER = struct.Struct("<8siiiiq")
+RECORD = struct.Struct("<ddic3x")
+MAGIC = b"PARTBIN\0"
+VERSION = 1
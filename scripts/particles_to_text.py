@@ -0,0 +1,57 @@
+#!/usr/bin/env python3
+"""Convert the binary particle output to the per-cell text files.
+
+./particle ... --output-format binary writes all particles into a single file,
+particles.bin, in the output directory of the run. This script writes the
+sim_output_<x>_<y> files that the text format would have produced, next to it
+unless --out-dir is given. The layout is described in scripts/particle_format.py.
+
+Example:
+  scripts/particles_to_text.py output/sim_output_12-00-00-1-4-100-100/particles.bin
+"""
+
+import argparse
+import os
+import sys
+
+from particle_format import HEADER, MAGIC, RECORD, VERSION
+
+BANNER_BEGIN = "====================================== BEGIN =========================================="
+BANNER_RULE = "======================================================================================="
+BANNER_END = "====================================== END =========================================="
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("file", help="particles.bin written by the simulation")
+    parser.add_argument("--out-dir", help="directory for the text files (default: that of the file)")
+    args = parser.parse_args()
+
+    out_dir = args.out_dir or os.path.dirname(os.path.abspath(args.file))
+    os.makedirs(out_dir, exist_ok=True)
+
+    with open(args.file, "rb") as f:
+        magic, version, record_size, cells, _, num_particles = HEADER.unpack(f.read(HEADER.size))
+        if magic != MAGIC or version != VERSION or record_size != RECORD.size:
+            sys.exit("%s is not a version %d particle file" % (args.file, VERSION))
+
+        num_cells = cells * cells
+        ppc = num_particles // num_cells
+        for linear in range(num_cells):
+            count = num_particles - ppc * (num_cells - 1) if linear == num_cells - 1 else ppc
+            data = f.read(count * RECORD.size)
+            if len(data) != count * RECORD.size:
+                sys.exit("%s is truncated" % args.file)
+
+            x_index, y_index = divmod(linear, cells)
+            lines = [BANNER_BEGIN, "Cell:%d,%d" % (x_index, y_index), BANNER_RULE]
+            for x, y, gid, color in RECORD.iter_unpack(data):
+                lines.append("Particle:%d,%.15f,%.15f,%s" % (gid, x, y, color.decode("ascii")))
+            lines.append(BANNER_END)
+
+            with open(os.path.join(out_dir, "sim_output_%d_%d" % (x_index, y_index)), "w") as out:
+                out.write("\n".join(lines) + "\n")
+
+
+if __name__ == "__main__":
+    main()
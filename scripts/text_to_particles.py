@@ -0,0 +1,65 @@
+#!/usr/bin/env python3
+"""Convert a directory of text golden files to a binary golden file.
+
+Reads the sim_output_<x>_<y> files of a directory such as scripts/compareOutput/simple
+and writes particles.bin, in the format of --output-format binary (see
+scripts/particle_format.py for the layout), into the same directory unless --out
+is given. Cells verifying a run read particles.bin instead of their text file when
+it is present.
+
+Example:
+  scripts/text_to_particles.py scripts/compareOutput/simple
+"""
+
+import argparse
+import os
+import re
+import sys
+
+from particle_format import HEADER, MAGIC, RECORD, VERSION
+
+FILE_RE = re.compile(r"sim_output_(\d+)_(\d+)$")
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("directory", help="directory holding the sim_output_<x>_<y> files")
+    parser.add_argument("--out", help="output file (default: <directory>/particles.bin)")
+    args = parser.parse_args()
+
+    cells = {}
+    for name in os.listdir(args.directory):
+        match = FILE_RE.match(name)
+        if match:
+            cells[(int(match.group(1)), int(match.group(2)))] = os.path.join(args.directory, name)
+    if not cells:
+        sys.exit("no sim_output_<x>_<y> files in %s" % args.directory)
+
+    cells_per_dim = max(max(x, y) for x, y in cells) + 1
+    if len(cells) != cells_per_dim * cells_per_dim:
+        sys.exit("expected %d files for a %dx%d grid, found %d" % (cells_per_dim ** 2, cells_per_dim, cells_per_dim, len(cells)))
+
+    particles = []
+    for path in cells.values():
+        with open(path) as f:
+            for line in f:
+                if line.startswith("Particle:"):
+                    gid, x, y, color = line[len("Particle:"):].rstrip("\n").split(",")
+                    particles.append((int(gid), float(x), float(y), color[0]))
+
+    # Records are indexed by gid, so the gids must be exactly 1..n
+    particles.sort()
+    for index, particle in enumerate(particles):
+        if particle[0] != index + 1:
+            sys.exit("gid %d is missing or duplicated" % (index + 1))
+
+    out = args.out or os.path.join(args.directory, "particles.bin")
+    with open(out, "wb") as f:
+        f.write(HEADER.pack(MAGIC, VERSION, RECORD.size, cells_per_dim, 0, len(particles)))
+        for gid, x, y, color in particles:
+            f.write(RECORD.pack(x, y, gid, color.encode("ascii")))
+    print("%s: %d particles, %dx%d cells" % (out, len(particles), cells_per_dim, cells_per_dim))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,165 @@
+#include "aggregator.h"
+#include "particle_msg.h"
+#include <string.h>
+
+extern CProxy_Main mainProxy;
+extern CProxy_Cell cellProxy;
+
+ParticleAggregator::ParticleAggregator() {
+  numLocalCells = 0;
+  numMessagesSent = 0;
+  numBytesSent = 0;
+  numBatchesSent = 0;
+  numHandoffs = 0;
+}
+
+ParticleAggregator::ParticleAggregator(CkMigrateMessage *m) : CBase_ParticleAggregator(m) {
+  numLocalCells = 0;
+  numMessagesSent = 0;
+  numBytesSent = 0;
+  numBatchesSent = 0;
+  numHandoffs = 0;
+}
+
+ParticleAggregator::PendingIteration &ParticleAggregator::slotFor(int iter) {
+  int freeSlot = -1;
+  for(int i=0; i<slots.size(); i++) {
+    if(slots[i].iter == iter)
+      return slots[i];
+    if(slots[i].iter == -1 && freeSlot == -1)
+      freeSlot = i;
+  }
+
+  // Cells on this PE can be at most a few iterations apart, so only a handful
+  // of slots ever exist and their buffers are reused from then on
+  if(freeSlot == -1) {
+    freeSlot = slots.size();
+    slots.push_back(PendingIteration());
+    slots[freeSlot].perPe.resize(CkNumPes());
+  }
+  slots[freeSlot].iter = iter;
+  slots[freeSlot].numDeposits = 0;
+  return slots[freeSlot];
+}
+
+// Append a batch header for destination cell (destX, destY) to the buffer of its PE
+// and return where the payloadBytes bytes of the batch go
+char *ParticleAggregator::appendBatch(int iter, int destX, int destY, int senderX, int senderY, int numParticles, int numPackedBytes, int payloadBytes) {
+  PendingIteration &slot = slotFor(iter);
+  int destPe = cellProxy.ckLocalBranch()->lastKnown(CkArrayIndex2D(destX, destY));
+
+  std::vector<char> &buffer = slot.perPe[destPe];
+  if(buffer.empty())
+    slot.touchedPes.push_back(destPe);
+
+  BatchHeader header;
+  header.iter = iter;
+  header.destX = destX;
+  header.destY = destY;
+  header.senderX = senderX;
+  header.senderY = senderY;
+  header.numParticles = numParticles;
+  header.numPackedBytes = numPackedBytes;
+
+  int offset = buffer.size();
+  buffer.resize(offset + sizeof(BatchHeader) + payloadBytes);
+  memcpy(buffer.data() + offset, &header, sizeof(BatchHeader));
+
+  numBatchesSent++;
+  return buffer.data() + offset + sizeof(BatchHeader);
+}
+
+void ParticleAggregator::deposit(int iter, int destX, int destY, int senderX, int senderY, const ParticleArray &batch) {
+  int n = batch.size();
+  char *out = appendBatch(iter, destX, destY, senderX, senderY, n, 0, n*(sizeof(int) + 2*sizeof(double) + sizeof(char)));
+
+  memcpy(out, batch.gid.data(), n*sizeof(int)); out += n*sizeof(int);
+  memcpy(out, batch.x.data(), n*sizeof(double)); out += n*sizeof(double);
+  memcpy(out, batch.y.data(), n*sizeof(double)); out += n*sizeof(double);
+  memcpy(out, batch.color.data(), n*sizeof(char));
+}
+
+void ParticleAggregator::depositPacked(int iter, int destX, int destY, int senderX, int senderY, const char *packed, int numBytes) {
+  char *out = appendBatch(iter, destX, destY, senderX, senderY, ParticleCodec::decodedCount(packed), numBytes, numBytes);
+  memcpy(out, packed, numBytes);
+}
+
+void ParticleAggregator::depositDone(int iter) {
+  PendingIteration &slot = slotFor(iter);
+  slot.numDeposits++;
+  if(slot.numDeposits == numLocalCells)
+    flush(slot);
+}
+
+void ParticleAggregator::flush(PendingIteration &slot) {
+  for(int i=0; i<slot.touchedPes.size(); i++) {
+    int pe = slot.touchedPes[i];
+    std::vector<char> &buffer = slot.perPe[pe];
+
+    AggregateMsg *msg = new (buffer.size()) AggregateMsg;
+    msg->numBytes = buffer.size();
+    memcpy(msg->data, buffer.data(), buffer.size());
+
+    numMessagesSent++;
+    numBytesSent += buffer.size();
+    thisProxy[pe].receiveAggregate(msg);
+
+    buffer.clear();
+  }
+  slot.touchedPes.clear();
+  slot.iter = -1;
+}
+
+void ParticleAggregator::countDirectSend(int numBytes) {
+  numMessagesSent++;
+  numBytesSent += numBytes;
+  numBatchesSent++;
+}
+
+void ParticleAggregator::countNotice(int numBytes) {
+  numMessagesSent++;
+  numBytesSent += numBytes;
+}
+
+void ParticleAggregator::receiveAggregate(AggregateMsg *msg) {
+  const char *in = msg->data;
+  const char *end = msg->data + msg->numBytes;
+
+  while(in < end) {
+    BatchHeader header;
+    memcpy(&header, in, sizeof(BatchHeader)); in += sizeof(BatchHeader);
+    int n = header.numParticles;
+
+    ParticleMsg *pmsg;
+    if(header.numPackedBytes > 0) {
+      pmsg = ParticleMsg::buildPacked(in, header.numPackedBytes, header.iter, header.senderX, header.senderY);
+      in += header.numPackedBytes;
+    } else {
+      pmsg = new (n, n, n, n, 0) ParticleMsg;
+      pmsg->iter = header.iter;
+      pmsg->senderX = header.senderX;
+      pmsg->senderY = header.senderY;
+      pmsg->numParticles = n;
+      pmsg->numPackedBytes = 0;
+      pmsg->numBatches = 1;
+      pmsg->viaInbox = false;
+      memcpy(pmsg->gid, in, n*sizeof(int)); in += n*sizeof(int);
+      memcpy(pmsg->x, in, n*sizeof(double)); in += n*sizeof(double);
+      memcpy(pmsg->y, in, n*sizeof(double)); in += n*sizeof(double);
+      memcpy(pmsg->color, in, n*sizeof(char)); in += n*sizeof(char);
+      CkSetRefNum(pmsg, header.iter);
+    }
+
+    if(header.iter == REORG_ITER)
+      cellProxy(header.destX, header.destY).recvReorgBatch(pmsg);
+    else
+      cellProxy(header.destX, header.destY).receiveUpdate(pmsg);
+  }
+  delete msg;
+}
+
+void ParticleAggregator::reportCounters() {
+  long counters[4] = { numMessagesSent, numBytesSent, numBatchesSent, numHandoffs };
+  CkCallback cb(CkIndex_Main::receiveExchangeCounters(NULL), mainProxy);
+  contribute(4*sizeof(long), counters, CkReduction::sum_long, cb);
+}
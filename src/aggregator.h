@@ -0,0 +1,84 @@
+#ifndef AGGREGATOR_H
+#define AGGREGATOR_H
+
+#include <vector>
+#include "particle_array.h"
+
+#include "particleSimulation.decl.h"
+
+/*
+*Per-PE aggregation of the neighbor exchange.
+*Every cell deposits its outgoing batches with the local branch. Once all cells
+*living on this PE have deposited their batches for an iteration, the branch sends
+*one AggregateMsg per destination PE, and the receiving branch demultiplexes it into
+*ParticleMsgs for the target cells. The branch also counts the exchange messages and
+*bytes leaving this PE, in both the aggregated and the direct mode.
+*/
+
+class AggregateMsg : public CMessage_AggregateMsg {
+public:
+    int numBytes;
+    char *data; // sequence of BatchHeader followed by the gid, x, y and color arrays or a packed batch
+};
+
+// Iteration number of the batches of the post-simulation reorganization, which go
+// to Cell::recvReorgBatch instead of receiveUpdate (iterations start at 1)
+#define REORG_ITER 0
+
+struct BatchHeader {
+    int iter;
+    int destX, destY;
+    int senderX, senderY;
+    int numParticles;
+    int numPackedBytes; // 0 for raw arrays, else the size of the ParticleCodec encoding that follows
+};
+
+class ParticleAggregator : public CBase_ParticleAggregator {
+  // batches waiting for the remaining local cells of one iteration
+  struct PendingIteration {
+    int iter;              // -1 when the slot is free
+    int numDeposits;       // number of local cells that deposited for iter
+    std::vector<std::vector<char> > perPe; // encoded batches by destination PE
+    std::vector<int> touchedPes;           // destination PEs with a non-empty buffer
+  };
+
+  std::vector<PendingIteration> slots;
+  int numLocalCells;
+
+  // exchange messages/bytes sent from this PE and batches carried by them,
+  // and batches handed over through the node inbox (whose notices are counted as messages)
+  long numMessagesSent, numBytesSent, numBatchesSent, numHandoffs;
+
+  PendingIteration &slotFor(int iter);
+  char *appendBatch(int iter, int destX, int destY, int senderX, int senderY, int numParticles, int numPackedBytes, int payloadBytes);
+  void flush(PendingIteration &slot);
+
+  public:
+    ParticleAggregator();
+    ParticleAggregator(CkMigrateMessage *m);
+
+    // Checkpoints are taken between iterations, when no batch is pending. The cells
+    // register again when they are restored, so only the counters are saved.
+    void pup(PUP::er &p) {
+      CBase_ParticleAggregator::pup(p);
+      p | numMessagesSent;
+      p | numBytesSent;
+      p | numBatchesSent;
+      p | numHandoffs;
+    }
+
+    void registerCell() { numLocalCells++; }
+    void unregisterCell() { numLocalCells--; }
+
+    void deposit(int iter, int destX, int destY, int senderX, int senderY, const ParticleArray &batch);
+    void depositPacked(int iter, int destX, int destY, int senderX, int senderY, const char *packed, int numBytes);
+    void depositDone(int iter);
+    void countDirectSend(int numBytes);
+    void countNotice(int numBytes);
+    void countHandoff() { numHandoffs++; }
+
+    void receiveAggregate(AggregateMsg *msg);
+    void reportCounters();
+};
+
+#endif
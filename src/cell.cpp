@@ -1,48 +1,78 @@
 #include "cell.h"
+#include "perturb_kernel.h"
+#include "particle_distribution.h"
+#include "particle_kernels.h"
+#include "particle_output.h"
+#include "golden_reader.h"
+#include <unistd.h>
 #include <iostream>
 #include <fstream>
 #include <string>
-#include <regex>
 #include <iomanip> //for set precision
+#include <math.h>
 #define DEBUG(x) //x
 
 extern CProxy_Main mainProxy;
 extern CProxy_Cell cellProxy;
 extern int particlesPerCell;
 extern int numCellsPerDim;
+extern int iterations;
 extern double boxMax;
 extern double boxMin;
 extern double cellDim;
 extern int velocityFactor;
 extern vector<int> particleRatio;
+extern int totalParticlesAllCells;
 extern bool logOutput;
+extern bool binaryOutput;
+extern bool verifyOutput;
+extern int perturbMode;
+extern int rngMode;
+extern bool compressMigrants;
+extern double compressErrorBound;
+extern int streamChunk;
+extern int streamFlush;
+extern int stepsPerExchange;
+extern int refineThreshold;
 
 
 #if LIVEVIZ_RUN
 extern double pixelScale;
 #endif
 
-extern CkReduction::reducerType totalOutboundType;
+extern CkReduction::reducerType stepReportType;
 
 Cell::Cell() {
   DEBUG(CmiPrintf("[%d][%d] ******************** Constructor *********************\n", thisIndex.x, thisIndex.y);)
   __sdag_init();
   iteration = 0;
   numOutbound = 0;
+  numFinalBatches = 0;
+  numBatchesReceived = 0;
+  numBatchesExpected = 0;
+  numChildren = 0;
+  numMergingChildren = 0;
+  childrenCreated = false;
+  reorgStarted = false;
+  numReorgArrived = 0;
+  for(int i=0; i<NUM_CHILDREN; i++)
+    childResident[i] = 0;
   usesAtSync = true;
+  usesAutoMeasure = !particleLoad;
+  aggregatorProxy.ckLocalBranch()->registerCell();
+  inboxProxy.ckLocalBranch()->setResident(linearIndex(), true);
   startX = (double) thisIndex.x*(cellDim);
   startY = (double) thisIndex.y*(cellDim);
 
   endX = startX + cellDim;
   endY = startY + cellDim;
-
-  custom_srand48(thisIndex.x + (numCellsPerDim)*thisIndex.y);
+  buildExchangeWindow();
 
   DEBUG(CmiPrintf("[%d][%d] ============================= Populating Cell=======\n", thisIndex.x, thisIndex.y);)
   populateCell(particlesPerCell); //creates random particles within the cell
   DEBUG(CmiPrintf("[%d][%d] ============================= Done Populating Cell=======\n", thisIndex.x, thisIndex.y);)
 
-  computeTotalParticles();
+  totalParticles = totalParticlesAllCells;
 
   // Code used for reorganization of particles after simulation
   ppcEqualDist = totalParticles/(numCellsPerDim * numCellsPerDim);
@@ -83,171 +113,470 @@ void Cell::populateCell(int initialElements) {
   DEBUG(CmiPrintf("[%d][%d] ============== Added %d particles and end id is %d =======\n", thisIndex.x, thisIndex.y, computeParticlesInCell(), startId);)
 }
 
+// Draw the two uniform numbers used to place the k-th particle of this cell.
+// Both generators are stateless, so particles can be placed in any order.
+void Cell::drawParticlePosition(int k, double &u0, double &u1) {
+  long stream = thisIndex.x + (numCellsPerDim)*thisIndex.y;
+
+  if(rngMode == RNG_PHILOX) {
+    custom_philox_uniform2(stream, k, &u0, &u1);
+  } else {
+    // Same values as seeding custom_srand48(stream) and drawing 2k+1, 2k+2 times
+    u0 = custom_drand48_at(stream, 2*(unsigned long long)k);
+    u1 = custom_drand48_at(stream, 2*(unsigned long long)k + 1);
+  }
+}
+
 void Cell::addParticlesOfColor(int num, char c, int &startId){
-  for(int i=1;i<=num;i++){
-    double randomXPosition= startX + custom_drand48()*(cellDim);
-    double randomYPosition= startY + custom_drand48()*(cellDim);
-    int id = startId + i;
+  int first = particles.size();
+  particles.resize(first + num);
+
+  for(int i=0;i<num;i++){
+    int k = first + i;
+    double u0, u1;
+    drawParticlePosition(k, u0, u1);
 
-    DEBUG(CmiPrintf("[%d][%d][%d]   [%d][%d] addParticlesOfColor x=%lf, y=%lf, color=%c, gid= %d\n", CmiMyPe(), CmiMyNode(), CmiMyRank(), thisIndex.x, thisIndex.y, randomXPosition, randomYPosition, c, id);)
-    Particle p(randomXPosition, randomYPosition, c, id);
+    particles.gid[k] = startId + i + 1;
+    particles.x[k] = startX + u0*(cellDim);
+    particles.y[k] = startY + u1*(cellDim);
+    particles.color[k] = c;
 
-    checkParticleBelongsToMe(p);
-    particles.push_back(p);
+    DEBUG(CmiPrintf("[%d][%d][%d]   [%d][%d] addParticlesOfColor x=%lf, y=%lf, color=%c, gid= %d\n", CmiMyPe(), CmiMyNode(), CmiMyRank(), thisIndex.x, thisIndex.y, particles.x[k], particles.y[k], c, particles.gid[k]);)
+    checkParticleBelongsToMe(particles.x[k], particles.y[k]);
   }
   startId += num; // Update the startId after adding num particles
 }
 
-//change the location of the particle within the range of 8 neighbours
+//change the location of every particle within the range of 8 neighbours
 //the location of the particles might exceed the bounds of the chare array
 //as a result of this functions, so you need to handle that case when deciding
 //which particle to go which neighbour chare
 //e.g. the right neighbour of chare indexed[k-1,0] is chare [0,0]
-void Cell::perturb(Particle* particle) {
+void Cell::perturb() {
+  perturb(0, particles.size());
+}
+
+// Perturb the n particles starting at index first
+void Cell::perturb(int first, int n) {
+  double begin = CkWallTimer();
+  perturbParticles(particles.x.data() + first, particles.y.data() + first, particles.color.data() + first, n, velocityFactor, perturbMode);
+  phaseTimers.charge(PHASE_PERTURB, PHASE_PACK, CkWallTimer() - begin);
+}
+
+
+// The message is owned (and freed) by the SDAG when clause that delivered it
+void Cell::updateNeighbor(ParticleMsg *msg){
+
+  DEBUG(CmiPrintf("[%d][%d] ============================= update neighbor beginning ITER: %d coming in from [%d][%d] =======\n", thisIndex.x, thisIndex.y, msg->iter, msg->senderX, msg->senderY);)
 
-  //CmiPrintf("[%d][%d] deltax, deltay [%lf, %lf]\n", thisIndex.x, thisIndex.y, deltax, deltay);
+  double begin = CkWallTimer();
+  int first = particles.size();
+  if(msg->viaInbox)
+    drainInbox(msg->iter);
+  else
+    msg->appendTo(particles);
 
-  checkParticleBelongsToMe(*particle);
-  double deltax = cos(particle->y);
-  double deltay = cos(particle->x);
-  assert(deltax >= -1 && deltax <= 1);
-  assert(deltay >= -1 && deltay <= 1);
+  double *x = particles.x.data();
+  double *y = particles.y.data();
 
-  if(particle->color=='r'){
-    particle->x += deltax/velocityFactor; // don't modify x coordinate
-    particle->y += deltay/velocityFactor;         // moves up by 0.3
+  wrapIncoming(x, y, first, particles.size(), thisIndex.x, thisIndex.y, numCellsPerDim, boxMin, boxMax);
+  for(int i=first; i<particles.size(); i++)
+    checkParticleBelongsToMe(x[i], y[i]);
+
+  phaseTimers.charge(PHASE_UNPACK, PHASE_WAIT, CkWallTimer() - begin);
+
+  DEBUG(CmiPrintf("[%d][%d] ============================= update neighbor end ITER: %d=======\n", thisIndex.x, thisIndex.y, msg->iter);)
+}
+
+// Send one batch of outgoing particles to the neighbor (xIndex, yIndex), whose
+// unwrapped origin (relative to this cell) is (originX, originY). numBatches is 0 for a
+// partial batch of a streamed exchange, else the number of batches sent to that neighbor
+void Cell::sendParticles(int xIndex, int yIndex, int iteration,  ParticleArray &outgoing, double originX, double originY, int numBatches) {
+  // A sparse exchange sends the count of the batches before an empty final batch instead
+  // of the batch. Within an aggregate an empty batch is only its header, so it goes as is.
+  if(sparseExchange && outgoing.empty() && !aggregateExchange) {
+    aggregatorProxy.ckLocalBranch()->countNotice(2*sizeof(int));
+    thisProxy(xIndex, yIndex).expectBatches(iteration, numBatches - 1);
+    return;
   }
-  else if(particle->color=='b'){
-    particle->x += deltax/(velocityFactor * 2);         // moves left by 0.1
-    particle->y += deltay/(velocityFactor * 2);         // moves down by 0.2
+
+  numOutbound += outgoing.size();
+  ParticleAggregator *aggregator = aggregatorProxy.ckLocalBranch();
+
+  if(nodeInbox && inboxProxy.ckLocalBranch()->isResident(xIndex*numCellsPerDim + yIndex)) {
+    handOff(xIndex, yIndex, iteration, outgoing, numBatches);
+    return;
   }
-  else if(particle->color=='g'){
-    particle->x += deltax/(velocityFactor * 5);         // moves right by 0.2
-    particle->y += deltay/(velocityFactor * 5);         // moves top by 0.1
+
+  if(compressMigrants) {
+    ParticleCodec codec(cellDim, compressErrorBound);
+    packBuffer.resize(codec.maxEncodedSize(outgoing.size()));
+    int numBytes = codec.encode(outgoing, originX, originY, packBuffer.data(), packOrder);
+
+    if(aggregateExchange) {
+      aggregator->depositPacked(iteration, xIndex, yIndex, thisIndex.x, thisIndex.y, packBuffer.data(), numBytes);
+    } else {
+      aggregator->countDirectSend(sizeof(ParticleMsg) + numBytes);
+      ParticleMsg *msg = ParticleMsg::buildPacked(packBuffer.data(), numBytes, iteration, thisIndex.x, thisIndex.y);
+      msg->numBatches = numBatches;
+      thisProxy(xIndex, yIndex).receiveUpdate(msg);
+    }
+  } else {
+    if(aggregateExchange) {
+      aggregator->deposit(iteration, xIndex, yIndex, thisIndex.x, thisIndex.y, outgoing);
+    } else {
+      int n = outgoing.size();
+      aggregator->countDirectSend(sizeof(ParticleMsg) + n*(sizeof(int) + 2*sizeof(double) + sizeof(char)));
+      ParticleMsg *msg = ParticleMsg::build(outgoing, iteration, thisIndex.x, thisIndex.y);
+      msg->numBatches = numBatches;
+      thisProxy(xIndex, yIndex).receiveUpdate(msg);
+    }
   }
 }
 
+// Adaptive refinement: send each child the particles that arrived in its sub-rectangle
+// and let it take its step
+void Cell::stepChildren(int iter) {
+  for(int i=0; i<numChildren; i++) {
+    subCellProxy(thisIndex.x, thisIndex.y, i).step(iter, pendingChild[i]);
+    pendingChild[i].clear();
+  }
+}
 
-void Cell::updateNeighbor(int iter, std::vector<Particle> incoming, int senderX, int senderY){
-
-  DEBUG(CmiPrintf("[%d][%d] ============================= update neighbor beginning ITER: %d coming in from [%d][%d] =======\n", thisIndex.x, thisIndex.y, iter, senderX, senderY);)
+// The particles that left a child join this cell's own (empty) particles, so that
+// updateParticles routes them to a sibling or a neighbor
+void Cell::collectChildLeavers(int child, int numResident, ParticleArray &leavers) {
+  childResident[child] = numResident;
+  particles.append(leavers.gid.data(), leavers.x.data(), leavers.y.data(), leavers.color.data(), leavers.size());
+}
 
-  for(int i=0; i<incoming.size(); i++) {
+// After the exchange: split a cell holding more than refineThreshold particles into
+// children, and merge them back once the cell holds less than half of that (and before
+// the final output, which expects every particle in its cell)
+void Cell::adaptDecomposition(int iter) {
+  numMergingChildren = 0;
+
+  if(numChildren > 0) {
+    if(iter == iterations || numOwnedParticles() < refineThreshold/2) {
+      for(int i=0; i<numChildren; i++) {
+        subCellProxy(thisIndex.x, thisIndex.y, i).merge(iter);
+        particles.append(pendingChild[i].gid.data(), pendingChild[i].x.data(), pendingChild[i].y.data(), pendingChild[i].color.data(), pendingChild[i].size());
+        pendingChild[i].clear();
+        childResident[i] = 0;
+      }
+      numMergingChildren = numChildren;
+      numChildren = 0;
+    } else {
+      distributeToChildren();
+    }
+  } else if(refineThreshold > 0 && particles.size() > refineThreshold && iter != iterations) {
+    // Children are inserted the first time and stay dormant while merged
+    if(!childrenCreated) {
+      double childDim = cellDim / REFINE_SPLIT;
+      for(int i=0; i<REFINE_SPLIT; i++)
+        for(int j=0; j<REFINE_SPLIT; j++)
+          subCellProxy(thisIndex.x, thisIndex.y, i*REFINE_SPLIT + j).insert(startX + i*childDim, startX + (i+1)*childDim, startY + j*childDim, startY + (j+1)*childDim);
+      subCellProxy.doneInserting();
+      childrenCreated = true;
+    }
+    numChildren = NUM_CHILDREN;
+    distributeToChildren();
+  }
+}
 
-    if(thisIndex.y == 0) { // Top boundary cell
+// Let every child this cell created, dormant ones included, join the load balancing step
+void Cell::syncChildren() {
+  if(!childrenCreated)
+    return;
+  for(int i=0; i<NUM_CHILDREN; i++)
+    subCellProxy(thisIndex.x, thisIndex.y, i).sync();
+}
 
-      if(incoming[i].y > boxMax) // reset position
-        incoming[i].y = incoming[i].y - boxMax;
+// Move this cell's particles to the pending batch of the child whose sub-rectangle holds them
+void Cell::distributeToChildren() {
+  double childDim = cellDim / REFINE_SPLIT;
+  for(int p=0; p<particles.size(); p++) {
+    int i = min((int) ((particles.x[p] - startX)/childDim), REFINE_SPLIT - 1);
+    int j = min((int) ((particles.y[p] - startY)/childDim), REFINE_SPLIT - 1);
+    pendingChild[max(i, 0)*REFINE_SPLIT + max(j, 0)].push_back(particles, p);
+  }
+  particles.clear();
+}
 
-    } else if(thisIndex.y == numCellsPerDim - 1) { // Bottom boundary cell
+// Particles of this cell, including the ones held by its children
+int Cell::numOwnedParticles() {
+  int count = particles.size();
+  for(int i=0; i<numChildren; i++)
+    count += childResident[i] + pendingChild[i].size();
+  return count;
+}
 
-      if(incoming[i].y < boxMin) //reset position
-        incoming[i].y = boxMax + incoming[i].y;
+// Node-local exchange: hand the batch to a cell in this process by swapping the
+// outgoing buffer into an inbox batch, and notify the cell with an empty message.
+// outgoing is left holding the (empty) arrays of a spare batch.
+void Cell::handOff(int xIndex, int yIndex, int iteration, ParticleArray &outgoing, int numBatches) {
+  ParticleInbox *inbox = inboxProxy.ckLocalBranch();
+  InboxBatch *batch = takeSpareBatch(inbox);
+  batch->iter = iteration;
+  batch->senderX = thisIndex.x;
+  batch->senderY = thisIndex.y;
+  batch->numBatches = numBatches;
+  batch->particles.swap(outgoing);
+  inbox->deliver(xIndex*numCellsPerDim + yIndex, batch);
+
+  ParticleAggregator *aggregator = aggregatorProxy.ckLocalBranch();
+  aggregator->countHandoff();
+  aggregator->countDirectSend(sizeof(ParticleMsg));
+
+  ParticleMsg *msg = ParticleMsg::buildNotice(iteration, thisIndex.x, thisIndex.y);
+  msg->numBatches = numBatches;
+  thisProxy(xIndex, yIndex).receiveUpdate(msg);
+}
 
+// Append the batches of iteration iter waiting in this cell's inbox and return the
+// emptied batches to their senders. A notice may find its batch already taken by an
+// earlier one, and batches a sender already pushed for the next iteration are put back.
+void Cell::drainInbox(int iter) {
+  ParticleInbox *inbox = inboxProxy.ckLocalBranch();
+
+  for(InboxBatch *batch = inbox->collect(linearIndex()), *next; batch != NULL; batch = next) {
+    next = batch->next;
+    if(batch->iter != iter) {
+      inbox->deliver(linearIndex(), batch);
+      continue;
     }
 
-    if(thisIndex.x == 0) { // Left boundary cell
+    ParticleArray &incoming = batch->particles;
+    particles.append(incoming.gid.data(), incoming.x.data(), incoming.y.data(), incoming.color.data(), incoming.size());
+    incoming.clear();
+    inbox->returnSpare(batch->senderX*numCellsPerDim + batch->senderY, batch);
+  }
+}
 
-      if(incoming[i].x > boxMax) // reset position
-        incoming[i].x = incoming[i].x - boxMax;
+InboxBatch *Cell::takeSpareBatch(ParticleInbox *inbox) {
+  if(spareBatches.empty()) {
+    for(InboxBatch *batch = inbox->collectSpares(linearIndex()); batch != NULL; batch = batch->next)
+      spareBatches.push_back(batch);
+  }
+  if(spareBatches.empty())
+    return new InboxBatch();
+
+  InboxBatch *batch = spareBatches.back();
+  spareBatches.pop_back();
+  return batch;
+}
 
-    } else if(thisIndex.x == numCellsPerDim - 1) { // Right boundary cell
+// Free the spare batches of this cell, including the ones still on their way back
+void Cell::releaseSpareBatches() {
+  if(nodeInbox) {
+    for(InboxBatch *batch = inboxProxy.ckLocalBranch()->collectSpares(linearIndex()); batch != NULL; batch = batch->next)
+      spareBatches.push_back(batch);
+  }
+  for(int i=0; i<spareBatches.size(); i++)
+    delete spareBatches[i];
+  spareBatches.clear();
+}
 
-      if(incoming[i].x < boxMin) // reset position
-        incoming[i].x = boxMax + incoming[i].x;
+// Set up the cells this cell sends particles to: every cell within windowRadius of this
+// one (see exchangeWindowRadius). Offsets that wrap onto the same cell share a slot.
+void Cell::buildExchangeWindow() {
+  windowSlot.clear();
+  windowX.clear();
+  windowY.clear();
+
+  if(stepsPerExchange == 1) {
+    numNeighbors = NUM_NEIGHBORS;
+    windowRadius = 1;
+    return;
+  }
 
+  windowRadius = exchangeWindowRadius(stepsPerExchange, velocityFactor, cellDim);
+  int width = 2*windowRadius + 1;
+  windowSlot.assign(width*width, -1);
+
+  for(int i=-windowRadius; i<=windowRadius; i++) {
+    for(int j=-windowRadius; j<=windowRadius; j++) {
+      int cx = ((thisIndex.x + i) % numCellsPerDim + numCellsPerDim) % numCellsPerDim;
+      int cy = ((thisIndex.y + j) % numCellsPerDim + numCellsPerDim) % numCellsPerDim;
+      if(cx == thisIndex.x && cy == thisIndex.y) continue;
+
+      // the first offset that reaches this cell gives it a slot
+      int &slot = windowSlot[windowOffset(cx, cy)];
+      if(slot < 0) {
+        slot = windowX.size();
+        windowX.push_back(cx);
+        windowY.push_back(cy);
+      }
     }
-    checkParticleBelongsToMe(incoming[i]);
   }
 
-  DEBUG(CmiPrintf("[%d][%d] ============================= update neighbor end ITER: %d=======\n", thisIndex.x, thisIndex.y, iter);)
-  particles.insert(particles.end(), incoming.begin(), incoming.end());
+  numNeighbors = windowX.size();
+  farOutgoing.resize(numNeighbors);
 }
 
-int Cell::computeParticlesInCell(int cellX, int cellY) {
-  int numParticles = 0;
+// Slot in the exchange window of the cell holding the (wrapped) position (x, y),
+// or -1 if that is this cell
+int Cell::exchangeSlot(double x, double y) {
+  if(x >= startX && x <= endX && y >= startY && y <= endY)
+    return -1;
+
+  int cx = cellOfCoordinate(x, cellDim, numCellsPerDim);
+  int cy = cellOfCoordinate(y, cellDim, numCellsPerDim);
+  if(cx == thisIndex.x && cy == thisIndex.y)
+    return -1;
+
+  int offset = windowOffset(cx, cy);
+  if(offset < 0)
+    CmiAbort("[%d][%d] Particle at (%lf, %lf) moved beyond the exchange window\n", thisIndex.x, thisIndex.y, x, y);
+  return windowSlot[offset];
+}
 
-  //lower half-green particles to be added
-  if(cellX < cellY)
-    numParticles += particleRatio[0] * particlesPerCell;
+// Index into windowSlot of cell (cx, cy), reached through the smallest offset from this
+// cell in each dimension, or -1 if the cell is outside the window
+int Cell::windowOffset(int cx, int cy) {
+  int ox = (cx - thisIndex.x + numCellsPerDim) % numCellsPerDim;
+  int oy = (cy - thisIndex.y + numCellsPerDim) % numCellsPerDim;
+  if(ox > windowRadius) ox -= numCellsPerDim;
+  if(oy > windowRadius) oy -= numCellsPerDim;
+  if(ox < -windowRadius || oy < -windowRadius)
+    return -1;
+
+  return (ox + windowRadius)*(2*windowRadius + 1) + oy + windowRadius;
+}
 
-  //upper half-blue particles to be added
-  if(cellX > cellY)
-    numParticles += particleRatio[1] * particlesPerCell;
+// Particles migrate at the end of every stepsPerExchange-th iteration and of the last one
+bool Cell::exchangesAt(int iter) {
+  return iter % stepsPerExchange == 0 || iter == iterations;
+}
 
-  //along the diagonal
-  if(cellX == cellY)
-    numParticles += particleRatio[2] * particlesPerCell;
+// Whether the iterations advanced since the previous exchange include a multiple of freq,
+// so that reductions and load balancing keep their cadence when exchanges are deferred
+bool Cell::windowReaches(int iter, int freq) {
+  int previousExchange = (iter - 1)/stepsPerExchange*stepsPerExchange;
+  return iter/freq > previousExchange/freq;
+}
 
-  int redBoxMin = (numCellsPerDim-(numCellsPerDim/4))/2;
+// Wrap positions that left the box back in, with the same arithmetic updateNeighbor
+// applies to migrants, so that deferred migration yields the same positions
+void Cell::wrapIntoBox(int first, int n) {
+  double *x = particles.x.data();
+  double *y = particles.y.data();
+
+  for(int i=first; i<first+n; i++) {
+    if(x[i] > boxMax)
+      x[i] = x[i] - boxMax;
+    else if(x[i] < boxMin)
+      x[i] = boxMax + x[i];
+
+    if(y[i] > boxMax)
+      y[i] = y[i] - boxMax;
+    else if(y[i] < boxMin)
+      y[i] = boxMax + y[i];
+  }
+}
 
-  //condition for adding red particles
-  if(cellX >= redBoxMin && cellX < redBoxMin+(numCellsPerDim/4) && cellY >= redBoxMin && cellY < redBoxMin +(numCellsPerDim/4))
-    numParticles += particleRatio[3] * particlesPerCell;
+// Streamed or sparse exchange: account for one received batch
+void Cell::countBatch(ParticleMsg *msg) {
+  numBatchesReceived++;
+  if(msg->numBatches > 0)
+    countAnnouncedBatches(msg->numBatches);
+}
 
-  return numParticles;
+// A final batch or a count from a neighbor announces how many batches it sent
+void Cell::countAnnouncedBatches(int numBatches) {
+  numFinalBatches++;
+  numBatchesExpected += numBatches;
 }
+
+int Cell::computeParticlesInCell(int cellX, int cellY) {
+  return ParticleDistribution(numCellsPerDim, particlesPerCell, particleRatio).particlesInCell(cellX, cellY);
+}
+
 int Cell::computeParticlesInCell() {
   return computeParticlesInCell(thisIndex.x, thisIndex.y);
 }
 
 int Cell::getParticleStartId() {
-  int startId = 0;
-  for(int j=0; j <= thisIndex.y; j++) { // iterate over columns
-    for(int i=0; i < numCellsPerDim; i++) { // iterate over rows
-      if(j == thisIndex.y && i == thisIndex.x)
-        return startId;
-      startId += computeParticlesInCell(i, j);
-    }
-  }
-  CkAbort("Cell [%d][%d] Couldn't obtain startId for this cell, error!", thisIndex.x, thisIndex.y);
-  return -1;
+  return ParticleDistribution(numCellsPerDim, particlesPerCell, particleRatio).particlesBeforeCell(thisIndex.x, thisIndex.y);
 }
 
-void Cell::reduceTotalAndOutbound() {
-  numParticles=particles.size();
-  data[0]= numParticles;
-  data[1]= numOutbound;
-  data[2]= iteration;
-  CkCallback cbTotalAndOutbound(CkIndex_Main::receiveTotalOutboundReductionData(NULL),mainProxy);
+void Cell::reduceStepReport() {
+  numParticles=numOwnedParticles();
+  StepReport report;
+  report.total = numParticles;
+  report.outbound = numOutbound;
+  report.iter = iteration;
+  report.maxParticles = report.minParticles = numParticles;
+  report.maxCellX = report.minCellX = thisIndex.x;
+  report.maxCellY = report.minCellY = thisIndex.y;
+  phaseTimers.fill(report.phases, linearIndex());
+  phaseTimers.reset();
+  CkCallback cbStepReport(CkIndex_Main::receiveStepReport(NULL),mainProxy);
+
+  contribute(sizeof(StepReport), &report, stepReportType, cbStepReport);
+}
 
-  contribute(3*sizeof(int), data, totalOutboundType, cbTotalAndOutbound);
+// Stage this cell's particles for the snapshot of iteration iter
+void Cell::takeSnapshot(int iter) {
+  phaseTimers.start();
+  snapshotProxy.ckLocalBranch()->stage(iter, thisIndex.x, thisIndex.y, particles);
+  phaseTimers.stop(PHASE_SNAPSHOT);
 }
 
-void Cell::computeTotalParticles() {
-  totalParticles = 0;
-  for(int j=0; j < numCellsPerDim; j++) { // iterate over columns
-    for(int i=0; i < numCellsPerDim; i++) { // iterate over rows
-      totalParticles += computeParticlesInCell(i, j);
-    }
-  }
-  DEBUG(CmiPrintf("[%d][%d] Total Particles are %d\n", thisIndex.x, thisIndex.y, totalParticles);)
+// Join the reduction that lets Main start the checkpoint of this iteration
+void Cell::readyForCheckpoint() {
+  CkCallback cb(CkReductionTarget(Main, startCheckpoint), mainProxy);
+  contribute(sizeof(int), &iteration, CkReduction::max_int, cb);
 }
 
-void Cell::recvParticlesPostSimulation(vector<Particle> inbound) {
+// Allocate my share of the reorganized particles, sorted by construction, and the bitmap
+// of the gids that arrived
+void Cell::prepareReorganization() {
+  if(reorgParticles.size() == (size_t) myShare && reorgArrived.size() == (size_t) myShare)
+    return;
+  reorgParticles.resize(myShare);
+  reorgArrived.assign(myShare, false);
+  numReorgArrived = 0;
+}
 
-  if(reorgParticles.size() == 0) {
-    reorgParticles.reserve(myShare);
+// A batch of the reorganization, aggregated per PE by the ParticleAggregator. Each particle
+// goes straight to its slot, so a gid outside my range or arriving twice is caught here.
+void Cell::recvReorgBatch(ParticleMsg *msg) {
+  prepareReorganization();
+
+  int firstGid = firstReorgGid();
+  for(int i=0; i<msg->numParticles; i++) {
+    int index = msg->gid[i] - firstGid;
+    if(index < 0 || index >= myShare)
+      CkAbort("[%d][%d] Particle %d does not belong to my gids [%d, %d]\n", thisIndex.x, thisIndex.y, msg->gid[i], firstGid, firstGid + myShare - 1);
+    if(reorgArrived[index])
+      CkAbort("[%d][%d] Particle %d arrived twice\n", thisIndex.x, thisIndex.y, msg->gid[i]);
+
+    reorgArrived[index] = true;
+    reorgParticles[index] = Particle(msg->x[i], msg->y[i], msg->color[i], msg->gid[i]);
   }
+  numReorgArrived += msg->numParticles;
+  delete msg;
 
-  reorgParticles.insert(reorgParticles.end(), inbound.begin(), inbound.end());
+  finishReorganization();
+}
 
-  if(reorgParticles.size() == myShare) {
+// Write and verify my share once all of it has arrived and outputFolderName is known
+void Cell::finishReorganization() {
+  if(!reorgStarted || numReorgArrived != myShare)
+    return;
 
-    if(logOutput) {
-      sortAndDump(outputFolderName);
-    }
+  if(logOutput) {
+    sortAndDump(outputFolderName);
+  }
 
+  if(verifyOutput) {
     verifyCorrectness();
-
-    // reduce to Main::done()
-    CkCallback doneCb(CkIndex_Main::done(), mainProxy);
-    contribute(doneCb);
-
-
-  } else if(reorgParticles.size() > myShare) {
-    CkAbort("[%d][%d] I currently have %lu particles, which is more than my share of %d particles\n", thisIndex.x, thisIndex.y, reorgParticles.size(), myShare);
   }
+
+  // reduce to Main::done()
+  CkCallback doneCb(CkIndex_Main::done(), mainProxy);
+  contribute(doneCb);
 }
 
 void Cell::readComparisonOutputFromFiles() {
@@ -262,49 +591,27 @@ void Cell::readComparisonOutputFromFiles() {
     CkPrintf("No comparison data available currently!\n");
   }
 
+  // A particles.bin next to the text files is read instead of them
+  string binaryFile = comparisonFile + PARTICLE_FILE_NAME;
   comparisonFile += "sim_output_" + to_string(thisIndex.x) + "_" + to_string(thisIndex.y);
 
-  DEBUG(CkPrintf("[%d][%d] Comparison file is %s\n", thisIndex.x, thisIndex.y, comparisonFile.c_str());)
-
-  ifstream infile(comparisonFile);
-  string line, token;
-  Particle p;
-
-  regex particleLine("(Particle)(.*)");
-  precomputeParticles.reserve(myShare);
-
-  while(getline(infile, line)) {
-
-    if(regex_match(line, particleLine)) {
-
-      istringstream iss1(line);
-      getline(iss1, token, ':'); // discard 'Particle' text
-      getline(iss1, token, ':');
-
-      istringstream iss2(token);
-
-      getline(iss2, token, ',');
-      p.gid = stoi(token);
-
-      getline(iss2, token, ',');
-      p.x = stod(token);
-
-      getline(iss2, token, ',');
-      p.y = stod(token);
-
-      getline(iss2, token, ',');
-      p.color = token[0];
-
-      precomputeParticles.push_back(p);
-    }
+  precomputeParticles.resize(myShare);
+  int numRead;
+  if(access(binaryFile.c_str(), R_OK) == 0) {
+    DEBUG(CkPrintf("[%d][%d] Comparison file is %s\n", thisIndex.x, thisIndex.y, binaryFile.c_str());)
+    numRead = readBinaryGolden(binaryFile, numCellsPerDim, (int64_t) linearIndex() * ppcEqualDist, myShare, precomputeParticles.data());
+  } else {
+    DEBUG(CkPrintf("[%d][%d] Comparison file is %s\n", thisIndex.x, thisIndex.y, comparisonFile.c_str());)
+    numRead = readTextGolden(comparisonFile, precomputeParticles.data(), myShare);
   }
+
+  // A missing or mismatching file leaves fewer particles than expected, which verifyCorrectness reports
+  precomputeParticles.resize(numRead < 0 ? 0 : numRead);
 }
 
 void Cell::verifyCorrectness() {
 
-  // locally sort received reorg particles before comparison
-  sort(reorgParticles.begin(), reorgParticles.end());
-
+  // reorgParticles is already in gid order, as every particle was placed at its slot
   readComparisonOutputFromFiles();
 
   // Verify correctness
@@ -313,57 +620,61 @@ void Cell::verifyCorrectness() {
 
   for(int i=0; i < precomputeParticles.size(); i++) {
     assert(precomputeParticles[i].gid == reorgParticles[i].gid);
-    assert(fabs(precomputeParticles[i].x - reorgParticles[i].x) < 1e-6);
-    assert(fabs(precomputeParticles[i].y - reorgParticles[i].y) < 1e-6);
+    assert(fabs(precomputeParticles[i].x - reorgParticles[i].x) < VERIFY_TOLERANCE);
+    assert(fabs(precomputeParticles[i].y - reorgParticles[i].y) < VERIFY_TOLERANCE);
     assert(precomputeParticles[i].color == reorgParticles[i].color);
   }
 
   DEBUG(CkPrintf("[%d][%d] Correctness verified\n", thisIndex.x, thisIndex.y);)
 }
 
-void Cell::sendParticlesPostSimulation(int linearCellId, vector<Particle> &outbound) {
-  assert(linearCellId >= 0 && linearCellId < (numCellsPerDim * numCellsPerDim));
-
-  int xCellId = linearCellId / numCellsPerDim;
-  int yCellId = linearCellId % numCellsPerDim;
-  thisProxy(xCellId, yCellId).recvParticlesPostSimulation(outbound);
-}
-
+// Send every particle to the cell owning its gid. A counting pass groups the particles
+// by owner without sorting them, and the batches go through the per-PE aggregator, so
+// each PE sends one message to every PE holding an owner cell.
 void Cell::reorganizeParticles(string subFolderName) {
-  sort(particles.begin(), particles.end());
   outputFolderName = subFolderName;
 
   DEBUG(CkPrintf("[%d][%d] My share is %d\n", thisIndex.x, thisIndex.y, myShare);)
 
-  int linearCellId = -1, prevLinearCellId = -1;
-  vector<Particle> outbound;
-
-  for(int i=0 ; i<particles.size(); i++) {
+  int numCells = numCellsPerDim * numCellsPerDim;
+  vector<int> owners;
+  vector<ParticleArray> buckets;
+  bucketByOwner(particles, ppcEqualDist, numCells, owners, buckets);
 
-    linearCellId = (particles[i].gid - 1)/ppcEqualDist;
-
-    if(linearCellId == numCellsPerDim * numCellsPerDim)
-      linearCellId = linearCellId - 1;
+  ParticleAggregator *aggregator = aggregatorProxy.ckLocalBranch();
+  for(int b=0; b<owners.size(); b++) {
+    assert(owners[b] >= 0 && owners[b] < numCells);
+    aggregator->deposit(REORG_ITER, owners[b] / numCellsPerDim, owners[b] % numCellsPerDim, thisIndex.x, thisIndex.y, buckets[b]);
+  }
+  aggregator->depositDone(REORG_ITER);
 
-    if(prevLinearCellId != linearCellId && prevLinearCellId != -1) {
-      // Send the outbound particles
-      sendParticlesPostSimulation(prevLinearCellId, outbound);
-      outbound.clear();
-    }
+  reorgStarted = true;
+  prepareReorganization();
+  finishReorganization();
+}
 
-    outbound.push_back(particles[i]);
-    prevLinearCellId = linearCellId;
-  }
+// Called once the reorganization is quiescent: a cell still short of its share lost particles
+void Cell::checkReorganization() {
+  if(numReorgArrived == myShare)
+    return;
 
-  // Send the last set of outbound particles
-  if(outbound.size() != 0)
-    sendParticlesPostSimulation(prevLinearCellId, outbound);
+  int firstMissing = 0;
+  while(firstMissing < myShare && reorgArrived[firstMissing])
+    firstMissing++;
+  CkAbort("[%d][%d] %d of my %d particles never arrived, the first missing gid is %d\n", thisIndex.x, thisIndex.y,
+          myShare - numReorgArrived, myShare, firstReorgGid() + firstMissing);
 }
 
 void Cell::sortAndDump(string subFolderName) {
 
-  // sort particles before writing into files
-  sort(reorgParticles.begin(), reorgParticles.end());
+  // reorgParticles is already in gid order
+  if(binaryOutput) {
+    // This cell holds the gids from linearIndex()*ppcEqualDist + 1 on, which fixes its offset in the shared file
+    int64_t firstRecord = (int64_t) linearIndex() * ppcEqualDist;
+    CkAssert(reorgParticles.empty() || reorgParticles[0].gid == firstRecord + 1);
+    writeParticleRecords(subFolderName + "/" PARTICLE_FILE_NAME, firstRecord, reorgParticles);
+    return;
+  }
 
   // Create a file
   ofstream myFile;
@@ -376,9 +687,11 @@ void Cell::sortAndDump(string subFolderName) {
     myFile << "Cell:"<<thisIndex.x <<","<< thisIndex.y<< endl;
     myFile << "=======================================================================================" << endl;
 
+    // '\n' rather than endl, which would flush the stream after every particle
+    myFile << fixed << setprecision(15);
     for(int i=0; i<reorgParticles.size(); i++) {
       DEBUG(CmiPrintf("[%d][%d] Final particle Sorted gid=%d => x=%lf, y=%lf, color=%c\n", thisIndex.x, thisIndex.y, reorgParticles[i].gid, reorgParticles[i].x, reorgParticles[i].y, reorgParticles[i].color);)
-      myFile << "Particle:"<< reorgParticles[i].gid << fixed << setprecision(15) << ","<< reorgParticles[i].x << "," << reorgParticles[i].y << "," << reorgParticles[i].color << endl;
+      myFile << "Particle:"<< reorgParticles[i].gid << ","<< reorgParticles[i].x << "," << reorgParticles[i].y << "," << reorgParticles[i].color << '\n';
     }
     myFile << "====================================== END ==========================================" << endl;
   } else {
@@ -412,14 +725,14 @@ void Cell::mapChareToImage(liveVizRequestMsg *m){
 
   for(int i=0;i<particles.size(); i++){
 
-    int xPoint = (particles[i].x - startX)*pixelScale;
-    int yPoint = (particles[i].y - startY)*pixelScale;
+    int xPoint = (particles.x[i] - startX)*pixelScale;
+    int yPoint = (particles.y[i] - startY)*pixelScale;
 
     if(xPoint>0 && xPoint<width && yPoint>0 && yPoint<height){
       int r=0, g=0, b=0;
-      if(particles[i].color=='r') r=255;
-      else if(particles[i].color=='g') g=255;
-      else if(particles[i].color=='b') b=255;
+      if(particles.color[i]=='r') r=255;
+      else if(particles.color[i]=='g') g=255;
+      else if(particles.color[i]=='b') b=255;
 
       int index = yPoint * width + xPoint;
 
@@ -8,25 +8,56 @@
 #include <assert.h>
 using namespace std;
 #include "particle.h"
+#include "particle_array.h"
+#include "particle_kernels.h"
 
 #if LIVEVIZ_RUN
 #include "liveViz.h"
 #endif
 
 #include "particleSimulation.decl.h"
+#include "particle_msg.h"
+#include "aggregator.h"
+#include "node_inbox.h"
+#include "snapshot_writer.h"
+#include "sub_cell.h"
+#include "step_report.h"
 #include "custom_rand_gen.h"
 
+extern CProxy_ParticleAggregator aggregatorProxy;
+extern CProxy_ParticleInbox inboxProxy;
+extern CProxy_SnapshotWriter snapshotProxy;
+extern bool aggregateExchange;
+extern bool sparseExchange;
+extern bool compressMigrants;
+extern double compressErrorBound;
+extern int streamChunk;
+extern int streamFlush;
+extern int stepsPerExchange;
+extern bool nodeInbox;
+extern bool particleLoad;
+extern int refineThreshold;
+extern int snapshotFreq;
+extern int checkpointFreq;
+extern CProxy_SubCell subCellProxy;
+extern int numCellsPerDim;
+
+#define NUM_NEIGHBORS 8
+
+// largest difference from the precomputed output that verifyCorrectness accepts
+#define VERIFY_TOLERANCE 1e-6
+
 // This class represent the cells of the simulation.
-/// Each cell contains a vector of particle.
+/// Each cell contains an array of particles.
 // On each time step, the cell perturbs the particles and moves them to neighboring cells as necessary.
 class Cell: public CBase_Cell {
   Cell_SDAG_CODE
 
   public:
-    int iteration, numReceived, numParticles, data[3];
+    int iteration, numReceived, numParticles;
 
-    // vector of my particles
-    vector<Particle> particles;
+    // my particles, stored as separate gid/x/y/color arrays
+    ParticleArray particles;
 
     // startX is my cell's starting X coordinate
     // endX is my cell's ending X coordinate
@@ -38,8 +69,71 @@ class Cell: public CBase_Cell {
 
     int numOutbound;
 
+    // counted (streamed or sparse) exchange state: batches sent to each neighbor, final
+    // batches or counts and batches received, and batches announced by the finals
+    // (not pupped: reset every iteration)
+    int batchesSent[NUM_NEIGHBORS];
+    int numFinalBatches, numBatchesReceived, numBatchesExpected;
+
+    // per-neighbor buffers of outgoing particles, reused every iteration
+    // (not pupped: they are always empty between iterations)
+    ParticleArray outgoing[NUM_NEIGHBORS];
+
+    // cells this cell exchanges particles with: the 8 neighbors, or with stepsPerExchange > 1
+    // every distinct cell within windowRadius in each dimension. windowSlot maps the offset
+    // of a destination cell (each in [-windowRadius, windowRadius]) to its index in
+    // windowX/windowY/farOutgoing, or -1 (not pupped: rebuilt from the cell index)
+    int numNeighbors;
+    int windowRadius;
+    vector<int> windowSlot;
+    vector<int> windowX, windowY;
+    vector<ParticleArray> farOutgoing;
+
+    // adaptive refinement: number of active children (0 or NUM_CHILDREN), children being
+    // merged back this iteration, whether the children were ever inserted, particles each
+    // child kept after its last step and particles waiting to be sent to each child
+    int numChildren, numMergingChildren, numChildReplies;
+    bool childrenCreated;
+    int childResident[NUM_CHILDREN];
+    ParticleArray pendingChild[NUM_CHILDREN];
+
+    // time spent in each phase since the last reduction
+    PhaseTimers phaseTimers;
+
+    // emptied inbox batches ready to carry the next handoff (not pupped: they belong to this process)
+    vector<InboxBatch *> spareBatches;
+
+    // scratch space for encoding compressed batches (not pupped)
+    vector<char> packBuffer;
+    vector<int> packOrder;
+
     Cell();
     Cell(CkMigrateMessage* m) {}
+    ~Cell() { releaseSpareBatches(); }
+
+    // Cells only migrate during load balancing; the phase is timed on each PE separately
+    void ckAboutToMigrate() {
+      phaseTimers.stop(PHASE_LB);
+      aggregatorProxy.ckLocalBranch()->unregisterCell();
+      inboxProxy.ckLocalBranch()->setResident(linearIndex(), false);
+    }
+    void ckJustMigrated() {
+      CBase_Cell::ckJustMigrated();
+      phaseTimers.start();
+      aggregatorProxy.ckLocalBranch()->registerCell();
+      inboxProxy.ckLocalBranch()->setResident(linearIndex(), true);
+      buildExchangeWindow();
+    }
+    // Restarting from a checkpoint rebuilds the same process-local state as a migration
+    void ckJustRestored() {
+      CBase_Cell::ckJustRestored();
+      aggregatorProxy.ckLocalBranch()->registerCell();
+      inboxProxy.ckLocalBranch()->setResident(linearIndex(), true);
+      buildExchangeWindow();
+    }
+
+    // With --particle-load the load balancer sees the particle count instead of the measured time
+    void UserSetLBLoad() { setObjTime(particles.size()); }
 
     void pup(PUP::er &p){
       CBase_Cell::pup(p);
@@ -53,13 +147,20 @@ class Cell: public CBase_Cell {
       p | numOutbound;
       p | myShare;
       p | ppcEqualDist;
+      p | reorgStarted;
+      p | phaseTimers;
+      p | numChildren;
+      p | childrenCreated;
+      PUParray(p, childResident, NUM_CHILDREN);
+      for(int i=0; i<NUM_CHILDREN; i++)
+        p | pendingChild[i];
     }
 
     void updateParticles(int iter);
-    void updateNeighbor(int iter, std::vector<Particle> incoming, int senderX, int senderY);
+    void updateNeighbor(ParticleMsg *msg);
     void sortAndDump(string subFolderName);
     void reorganizeParticles(string subFolderName);
-    void recvParticlesPostSimulation(vector<Particle> inbound);
+    void recvReorgBatch(ParticleMsg *msg);
 
     void verifyCorrectness();
 
@@ -67,38 +168,76 @@ class Cell: public CBase_Cell {
     void mapChareToImage(liveVizRequestMsg *m);
 #endif
 
-#if BONUS_QUESTION
-    void contributeToReduction();
-#endif
-
   private:
     void populateCell(int initialElements);
-    void perturb(Particle* particle);
+    void perturb();
+    void perturb(int first, int n);
     void addParticlesOfColor(int num, char c, int &startId);
+    void drawParticlePosition(int k, double &u0, double &u1);
+
+    void reduceStepReport();
+    void takeSnapshot(int iter);
+    void readyForCheckpoint();
+
+    void sendParticles(int xIndex, int yIndex, int iteration,  ParticleArray &outgoing, double originX, double originY, int numBatches);
+    void streamParticles(int iter);
+    void flushNeighbor(int dirX, int dirY, int iter, bool last);
+    void countBatch(ParticleMsg *msg);
+    void countAnnouncedBatches(int numBatches);
+
+    int linearIndex() { return thisIndex.x * numCellsPerDim + thisIndex.y; }
+    void handOff(int xIndex, int yIndex, int iteration, ParticleArray &outgoing, int numBatches);
+    void drainInbox(int iter);
+    InboxBatch *takeSpareBatch(ParticleInbox *inbox);
+    void releaseSpareBatches();
+
+    void stepChildren(int iter);
+    void collectChildLeavers(int child, int numResident, ParticleArray &leavers);
+    void adaptDecomposition(int iter);
+    void syncChildren();
+    void distributeToChildren();
+    int numOwnedParticles();
+
+    void buildExchangeWindow();
+    bool exchangesAt(int iter);
+    bool windowReaches(int iter, int freq);
+    void advanceParticles(int iter);
+    void wrapIntoBox(int first, int n);
+    int exchangeSlot(double x, double y);
+    int windowOffset(int cx, int cy);
+
+    // index into outgoing[] of the neighbor in direction (dirX, dirY), each in {-1, 0, 1}
+    int neighborIndex(int dirX, int dirY) { return neighborSlot(dirX, dirY); }
+
+    void finishReorganization();
+    void checkReorganization();
+
+    void checkParticleBelongsToMe(double x, double y) {
+        // Error checking
+        if(x < startX - 1e-6 || x > endX + 1e-6)
+          CmiAbort("[%d][%d] Particle X coordinate %lf doesn't belong in [%lf, %lf]\n", thisIndex.x, thisIndex.y, x, startX, endX);
 
-    void reduceTotalAndOutbound();
-
-    void sendParticles(int xIndex, int yIndex, int iteration,  std::vector<Particle> &outgoing) {
-      numOutbound += outgoing.size();
-      thisProxy(xIndex, yIndex).receiveUpdate(iteration, outgoing, thisIndex.x, thisIndex.y);
+        else if(y < startY - 1e-6 || y > endY + 1e-6)
+          CmiAbort("[%d][%d] Particle Y coordinate %lf doesn't belong in [%lf, %lf]\n", thisIndex.x, thisIndex.y, y, startY, endY);
     }
 
-    void sendParticlesPostSimulation(int linearCellId, vector<Particle> &outbound);
-
     void checkParticleBelongsToMe(Particle &p) {
-        // Error checking
-        if(p.x < startX - 1e-6 || p.x > endX + 1e-6)
-          CmiAbort("[%d][%d] Particle X coordinate %lf doesn't belong in [%lf, %lf]\n", thisIndex.x, thisIndex.y, p.x, startX, endX);
-
-        else if(p.y < startY - 1e-6 || p.y > endY + 1e-6)
-          CmiAbort("[%d][%d] Particle Y coordinate %lf doesn't belong in [%lf, %lf]\n", thisIndex.x, thisIndex.y, p.y, startY, endY);
+        checkParticleBelongsToMe(p.x, p.y);
     }
 
     int totalParticles;
     int myShare;
     int ppcEqualDist;
-    // vector of my particles after reorganization
+    // my particles after reorganization, stored at index gid - firstReorgGid(), which of
+    // them arrived and how many, and whether this cell has sent its own particles out
+    // (batches from faster cells may arrive before that)
     vector<Particle> reorgParticles;
+    vector<bool> reorgArrived;
+    int numReorgArrived;
+    bool reorgStarted;
+
+    int firstReorgGid() { return linearIndex() * ppcEqualDist + 1; }
+    void prepareReorganization();
 
     // vector of particles read in from pre-computed output file
     // These particles are compared against simulation particles to verify correctness
@@ -106,8 +245,6 @@ class Cell: public CBase_Cell {
 
     string outputFolderName;
 
-    void computeTotalParticles();
-
     int computeParticlesInCell(int cellX, int cellY);
     int computeParticlesInCell();
     int getParticleStartId();
@@ -0,0 +1,63 @@
+#include "cell_map.h"
+#include <algorithm>
+
+extern int numCellsPerDim;
+
+CellMap::CellMap(int mode) : mode(mode) {
+  buildPlacement();
+}
+
+void CellMap::buildPlacement() {
+  int numCells = numCellsPerDim * numCellsPerDim;
+
+  int order = 0;
+  while((1 << order) < numCellsPerDim)
+    order++;
+
+  // Sort the cells along the curve, then cut the sequence into CkNumPes() blocks
+  std::vector<std::pair<long, int> > curve(numCells);
+  for(int x=0; x<numCellsPerDim; x++)
+    for(int y=0; y<numCellsPerDim; y++)
+      curve[x*numCellsPerDim + y] = std::make_pair(curveIndex(mode, order, x, y), x*numCellsPerDim + y);
+  std::sort(curve.begin(), curve.end());
+
+  peOfCell.resize(numCells);
+  for(int rank=0; rank<numCells; rank++)
+    peOfCell[curve[rank].second] = (int) ((long) rank * CkNumPes() / numCells);
+}
+
+int CellMap::procNum(int arrayHdl, const CkArrayIndex &idx) {
+  const int *index = idx.data();
+  return peOfCell[index[0]*numCellsPerDim + index[1]];
+}
+
+// Position of cell (x, y) on the curve of side 2^order
+long CellMap::curveIndex(int mode, int order, int x, int y) {
+  long d = 0;
+
+  if(mode == CELL_MAP_MORTON) {
+    for(int bit=0; bit<order; bit++) {
+      d |= (long) ((x >> bit) & 1) << (2*bit + 1);
+      d |= (long) ((y >> bit) & 1) << (2*bit);
+    }
+    return d;
+  }
+
+  // Hilbert curve: walk down the quadrants, rotating the frame at each level
+  for(int s = (1 << order)/2; s > 0; s /= 2) {
+    int rx = (x & s) > 0;
+    int ry = (y & s) > 0;
+    d += (long) s * s * ((3 * rx) ^ ry);
+
+    if(ry == 0) {
+      if(rx == 1) {
+        x = s - 1 - (x & (s - 1));
+        y = s - 1 - (y & (s - 1));
+      }
+      int t = x;
+      x = y;
+      y = t;
+    }
+  }
+  return d;
+}
@@ -0,0 +1,42 @@
+#ifndef CELL_MAP_H
+#define CELL_MAP_H
+
+#include <vector>
+
+#include "particleSimulation.decl.h"
+
+enum CellMapMode {CELL_MAP_DEFAULT=0, CELL_MAP_HILBERT=1, CELL_MAP_MORTON=2};
+
+/*
+*Placement of the cells along a space-filling curve (--map hilbert|morton).
+*The cells are ranked by their position on the curve and split into contiguous
+*blocks of equal size, block p going to PE p. Since the PEs of a node are numbered
+*consecutively, a node also gets a contiguous stretch of the curve, so most of the
+*8-neighbor exchange stays on the PE or on the node. Grids whose size is not a
+*power of two are ranked on the enclosing power-of-two curve.
+*/
+
+class CellMap : public CBase_CellMap {
+  int mode;
+  std::vector<int> peOfCell; // home PE of each cell, by x*numCellsPerDim + y
+
+  void buildPlacement();
+
+  public:
+    CellMap(int mode);
+    CellMap(CkMigrateMessage *m) : CBase_CellMap(m) {}
+
+    // Only the mode is saved, so a restart on another number of PEs gets its own placement
+    void pup(PUP::er &p) {
+      CBase_CellMap::pup(p);
+      p | mode;
+      if(p.isUnpacking())
+        buildPlacement();
+    }
+
+    int procNum(int arrayHdl, const CkArrayIndex &idx);
+
+    static long curveIndex(int mode, int order, int x, int y);
+};
+
+#endif
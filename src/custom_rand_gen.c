@@ -37,6 +37,8 @@
     v = F(); REST(v); }
 #define HI_BIT  (1L << (2 * N - 1))
 
+#include <math.h>
+
 static unsigned x[3] = { X0, X1, X2 }, a[3] = { A0, A1, A2 }, c = C;
 static unsigned short lastx[3];
 static void next();
@@ -161,6 +163,91 @@ NEST(long, custom_nrand48, custom_lrand48);
 
 NEST(long, custom_jrand48, custom_mrand48);
 
+/*
+ *  Stateless generators.  Neither of these touches the static state above, so
+ *  they can be called from any thread and for any draw in any order.
+ */
+
+#define LCG_MASK48  ((1ULL << 48) - 1)
+#define LCG_A       0x5DEECE66DULL
+#define LCG_C       0xBULL
+
+/*
+ *  Return the value of the (n+1)-th custom_drand48() call after
+ *  custom_srand48(seedval), i.e. custom_drand48_at(s, 0) is the first draw.
+ *  The 48-bit LCG is advanced n+1 steps at once by repeated squaring.
+ */
+double
+custom_drand48_at(long seedval, unsigned long long n)
+{
+  unsigned long long state, mult = 1, plus = 0;
+  unsigned long long curMult = LCG_A, curPlus = LCG_C;
+  unsigned long long steps = n + 1;
+
+  state = ((unsigned long long)(seedval & 0xFFFFFFFFL) << N) | X0;
+  while (steps > 0) {
+    if (steps & 1) {
+      mult = (mult * curMult) & LCG_MASK48;
+      plus = (plus * curMult + curPlus) & LCG_MASK48;
+    }
+    curPlus = ((curMult + 1) * curPlus) & LCG_MASK48;
+    curMult = (curMult * curMult) & LCG_MASK48;
+    steps >>= 1;
+  }
+  state = (mult * state + plus) & LCG_MASK48;
+  return ldexp((double)state, -48);
+}
+
+#define PHILOX_M0   0xD2511F53U
+#define PHILOX_M1   0xCD9E8D57U
+#define PHILOX_W0   0x9E3779B9U
+#define PHILOX_W1   0xBB67AE85U
+#define PHILOX_ROUNDS 10
+
+/*
+ *  Philox4x32-10 counter-based generator: the four output words are a
+ *  bijective function of the 128-bit counter under the 64-bit key.
+ */
+static void
+philox4x32(unsigned int ctr[4], unsigned int key0, unsigned int key1)
+{
+  int r;
+  unsigned long long p0, p1;
+  unsigned int c0, c1, c2, c3;
+
+  for (r = 0; r < PHILOX_ROUNDS; r++) {
+    p0 = (unsigned long long)PHILOX_M0 * ctr[0];
+    p1 = (unsigned long long)PHILOX_M1 * ctr[2];
+    c0 = (unsigned int)(p1 >> 32) ^ ctr[1] ^ key0;
+    c1 = (unsigned int)p1;
+    c2 = (unsigned int)(p0 >> 32) ^ ctr[3] ^ key1;
+    c3 = (unsigned int)p0;
+    ctr[0] = c0; ctr[1] = c1; ctr[2] = c2; ctr[3] = c3;
+    key0 += PHILOX_W0;
+    key1 += PHILOX_W1;
+  }
+}
+
+/*
+ *  Two uniform doubles in [0, 1) with 53 random bits each, keyed by a
+ *  stream id (e.g. a cell index) and indexed by a counter (e.g. a particle
+ *  index within that cell).
+ */
+void
+custom_philox_uniform2(unsigned int stream, unsigned long long counter, double *u0, double *u1)
+{
+  unsigned int ctr[4];
+  static const double two53m = 1.0 / 9007199254740992.0;
+
+  ctr[0] = (unsigned int)counter;
+  ctr[1] = (unsigned int)(counter >> 32);
+  ctr[2] = 0;
+  ctr[3] = 0;
+  philox4x32(ctr, stream, X0);
+  *u0 = ((ctr[0] >> 5) * 67108864.0 + (ctr[1] >> 6)) * two53m;
+  *u1 = ((ctr[2] >> 5) * 67108864.0 + (ctr[3] >> 6)) * two53m;
+}
+
 #ifdef DRIVER
 /*
  *  This should print the sequences of integers in Tables 2
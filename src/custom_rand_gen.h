@@ -1,4 +1,19 @@
+#ifndef CUSTOM_RAND_GEN_H
+#define CUSTOM_RAND_GEN_H
+
 extern "C" {
   double custom_drand48();
   double custom_srand48(long seedval);
+
+  // Stateless, thread-safe draws (see custom_rand_gen.c)
+  double custom_drand48_at(long seedval, unsigned long long n);
+  void custom_philox_uniform2(unsigned int stream, unsigned long long counter, double *u0, double *u1);
 }
+
+// Generator used to populate the cells
+enum RngMode {
+  RNG_DRAND48 = 0, // reproduces the custom_drand48 stream seeded per cell (matches the golden outputs)
+  RNG_PHILOX  = 1  // Philox4x32-10 keyed by the cell index
+};
+
+#endif
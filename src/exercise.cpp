@@ -22,22 +22,15 @@ using namespace std;
 #include "cell.h"
 #include "main.h"
 
-extern CkReduction::reducerType minMaxType;
-
 // Useful function declarations
 //void Cell::perturb(Particle* particle);
-//void Cell::sendParticles(int xIndex, int yIndex, int iteration,  std::vector<Particle> &outgoing);
-
-struct direction {
-  int x;
-  int y;
-} dir;
+//void Cell::sendParticles(int xIndex, int yIndex, int iteration,  ParticleArray &outgoing, double originX, double originY, int numBatches);
 
 //change the position of the particles and send messages to neighbors with their incoming particles
 void Cell::updateParticles(int iter) {
 
   // Variables to use
-  // 1. vector<Particle> particles (declared in cell.h)
+  // 1. ParticleArray particles (declared in cell.h)
   // 2. startX, endX (declared in cell.h). Example - The cell (2,3) will have startX = 2.0 and endX= 3.0
   // 3. startY, endY (declared in cell.h). Example - The cell (2,3) will have startY = 3.0 and endY = 4.0
   // 4. thisIndex.x represents my cell's x index (declared in the charm++ runtime system). Example - The cell (2,3) will have thisIndex.x as 2
@@ -50,40 +43,31 @@ void Cell::updateParticles(int iter) {
   //    if a particle with the index (7,7) goes to (7, 8), it should be sent back to (7, 0).
   // 4. Call sendParticles(...) to send the 8 different vector of particles to each of the 8 neighbours
 
-  const int dirPerDim = 3;
-  const int particlesAllCells = particlesPerCell * numCellsPerDim * numCellsPerDim;
-  Particle outgoing[dirPerDim][dirPerDim][particlesAllCells];
-  int size[dirPerDim][dirPerDim] = {0};
-  vector<Particle>::iterator par = particles.begin();
-  while (par != particles.end()) {
-    perturb(&(*par));
-    
-    dir.x = 0;
-    dir.y = 0;
-    
-    if (par->x < startX) {
-      --dir.x;
-      if (par->y < startY) --dir.y;
-      else if (par->y > endY) ++dir.y;
-    }
-    else if (par->x > endX) {
-      ++dir.x;
-      if (par->y < startY) --dir.y;
-      else if (par->y > endY) ++dir.y;
-    }
-    else {
-      if (par->y < startY) --dir.y;
-      else if (par->y > endY) ++dir.y;
-      else {
-        par++;
-        continue;
-      }
-    }
-    
-    outgoing[dir.x+1][dir.y+1][size[dir.x+1][dir.y+1]++] = *par;
-    par = particles.erase(par);
+  for (int n = 0; n < NUM_NEIGHBORS; n++)
+    outgoing[n].clear();
+
+  numFinalBatches = 0;
+  numBatchesReceived = 0;
+  numBatchesExpected = 0;
+
+  // The streamed and deferred exchanges perturb the particles themselves
+  if (streamChunk > 0) {
+    streamParticles(iter);
+    return;
+  }
+
+  if (stepsPerExchange > 1) {
+    advanceParticles(iter);
+    return;
   }
 
+  // Perturb all particles first with the batched kernel (the particles of a
+  // refined cell were already moved by its children)
+  if (numChildren == 0)
+    perturb();
+
+  partitionParticles(particles, startX, endX, startY, endY, outgoing);
+
   int x_out, y_out;
 
   for (int i = -1; i <= 1; i++) {
@@ -106,73 +90,105 @@ void Cell::updateParticles(int iter) {
         y_out = 0;
       }
 
-      vector<Particle> out(outgoing[i+1][j+1], outgoing[i+1][j+1]+size[i+1][j+1]);
-      sendParticles(x_out, y_out, iter, out);
+      sendParticles(x_out, y_out, iter, outgoing[neighborIndex(i, j)], startX + i*cellDim, startY + j*cellDim, 1);
     }
   }
+
+  // Let the aggregator flush once every cell on this PE has deposited its batches
+  if (aggregateExchange)
+    aggregatorProxy.ckLocalBranch()->depositDone(iter);
 }
 
-#if BONUS_QUESTION
-void Main::receiveMinMaxReductionData(CkReductionMsg *data) {
-  int *output = (int *) data->getData();
+// Deferred version of updateParticles: particles take one step and stay in this
+// cell, wrapped into the box, until an exchange iteration, where every particle
+// that left is sent to the cell it ended up in, which may be several cells away.
+void Cell::advanceParticles(int iter) {
+  perturb();
+  wrapIntoBox(0, particles.size());
+
+  if (!exchangesAt(iter))
+    return;
+
+  for (int n = 0; n < numNeighbors; n++)
+    farOutgoing[n].clear();
+
+  int numRemaining = particles.size();
+  int p = 0;
+  while (p < numRemaining) {
+    int slot = exchangeSlot(particles.x[p], particles.y[p]);
+    if (slot < 0) {
+      p++;
+      continue;
+    }
 
-  // TODO: Assign values to maxParticles, maxCellX, maxCellY, minParticles, minCellX, minCellY based
-  // on computed reduction values
+    farOutgoing[slot].push_back(particles, p);
+    particles.copy(p, --numRemaining);
+  }
+  particles.resize(numRemaining);
 
-  maxParticles = output[0];
-  maxCellX = output[1];
-  maxCellY = output[2];
-  minParticles = output[3];
-  minCellX = output[4];
-  minCellY = output[5];
+  // Positions are already wrapped, so each batch is relative to the absolute origin of its cell
+  for (int n = 0; n < numNeighbors; n++)
+    sendParticles(windowX[n], windowY[n], iter, farOutgoing[n], windowX[n]*cellDim, windowY[n]*cellDim, 1);
 
-  CmiPrintf("Max Particles:%d, Cell with Max Particles: (%d, %d)\n", maxParticles, maxCellX, maxCellY);
-  CmiPrintf("Min Particles:%d, Cell with Min Particles: (%d, %d)\n", minParticles, minCellX, minCellY);
-  readyToOutput();
+  if (aggregateExchange)
+    aggregatorProxy.ckLocalBranch()->depositDone(iter);
 }
 
-void Cell::contributeToReduction() {
-  numParticles = particles.size();
-
-  // TODO: Declare a callback with the function receiveMinMaxReductionData
-  // Add code to contribute to reduction for finding the different custom reduction values using the callback
-  // declared above
-
-  const int num_data = 6;
-
-  CkCallback cb(CkIndex_Main::receiveMinMaxReductionData(NULL), mainProxy);
+// Pipelined version of updateParticles: particles are perturbed and classified
+// streamChunk at a time, and a neighbor's buffer is sent as soon as it holds
+// streamFlush particles, so the first batches leave while the rest of the cell
+// is still being perturbed. A final batch to each neighbor carries the number
+// of batches it was sent.
+void Cell::streamParticles(int iter) {
+  for (int n = 0; n < NUM_NEIGHBORS; n++)
+    batchesSent[n] = 0;
+
+  // Particles of later chunks are not perturbed yet, so the remaining particles
+  // are compacted towards the front instead of being swapped in from the tail.
+  int count = particles.size();
+  int numKept = 0;
+  for (int first = 0; first < count; first += streamChunk) {
+    int last = min(first + streamChunk, count);
+    perturb(first, last - first);
+
+    const double *x = particles.x.data();
+    const double *y = particles.y.data();
+    for (int p = first; p < last; p++) {
+      int dirX = 0, dirY = 0;
+      if (x[p] < startX) dirX = -1;
+      else if (x[p] > endX) dirX = 1;
+
+      if (y[p] < startY) dirY = -1;
+      else if (y[p] > endY) dirY = 1;
+
+      if (dirX == 0 && dirY == 0) {
+        if (numKept != p)
+          particles.copy(numKept, p);
+        numKept++;
+        continue;
+      }
 
-  int data[num_data] = {numParticles, (int) startX, (int) startY, 
-                        numParticles, (int) startX, (int) startY};
+      ParticleArray &buffer = outgoing[neighborIndex(dirX, dirY)];
+      buffer.push_back(particles, p);
+      if (buffer.size() >= streamFlush)
+        flushNeighbor(dirX, dirY, iter, false);
+    }
+  }
+  particles.resize(numKept);
 
-  contribute(num_data*sizeof(int), data, minMaxType, cb);
+  for (int i = -1; i <= 1; i++)
+    for (int j = -1; j <= 1; j++)
+      if (i != 0 || j != 0)
+        flushNeighbor(i, j, iter, true);
 }
 
-CkReductionMsg *calculateMaxMin(int nMsg, CkReductionMsg **msgs) {
-  //TODO: Add code to compute the following:
-  // Value of the maximum particles per cell
-  // X coordinate of the cell with the maximum particles per cell
-  // Y coordinate of the cell with the maximum particles per cell
-  // Value of the minimum particles per cell
-  // X coordinate of the cell with the minimum particles per cell
-  // Y coordinate of the cell with the minimum particles per cell
-
-  const int num_data = 6;
-  int *retData = (int *) msgs[0]->getData();
-
-  for (int i = 1; i < nMsg; i++) {
-    int *data = (int *) msgs[i]->getData();
-    if (data[0] > retData[0]) {
-      retData[0] = data[0];
-      retData[1] = data[1];
-      retData[2] = data[2];
-    }
-    if (data[3] < retData[3]) {
-      retData[3] = data[3];
-      retData[4] = data[4];
-      retData[5] = data[5];
-    }
-  }
-  return CkReductionMsg::buildNew(num_data*sizeof(int), retData, minMaxType);
+// Send the buffered particles for the neighbor in direction (dirX, dirY)
+void Cell::flushNeighbor(int dirX, int dirY, int iter, bool last) {
+  int n = neighborIndex(dirX, dirY);
+  int x_out = (thisIndex.x + dirX + numCellsPerDim) % numCellsPerDim;
+  int y_out = (thisIndex.y + dirY + numCellsPerDim) % numCellsPerDim;
+
+  batchesSent[n]++;
+  sendParticles(x_out, y_out, iter, outgoing[n], startX + dirX*cellDim, startY + dirY*cellDim, last ? batchesSent[n] : 0);
+  outgoing[n].clear();
 }
-#endif
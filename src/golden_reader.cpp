@@ -0,0 +1,100 @@
+#include "golden_reader.h"
+#include "particle_output.h"
+#include <charconv>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#define PARTICLE_PREFIX "Particle:"
+#define PARTICLE_PREFIX_LENGTH (sizeof(PARTICLE_PREFIX) - 1)
+
+// Parse "gid,x,y,color" from [p, eol) into particle
+static bool parseParticle(const char *p, const char *eol, Particle &particle) {
+  std::from_chars_result r = std::from_chars(p, eol, particle.gid);
+  if(r.ec != std::errc() || r.ptr == eol || *r.ptr != ',')
+    return false;
+
+  r = std::from_chars(r.ptr + 1, eol, particle.x);
+  if(r.ec != std::errc() || r.ptr == eol || *r.ptr != ',')
+    return false;
+
+  r = std::from_chars(r.ptr + 1, eol, particle.y);
+  if(r.ec != std::errc() || r.ptr == eol || *r.ptr != ',' || r.ptr + 1 == eol)
+    return false;
+
+  particle.color = r.ptr[1];
+  return true;
+}
+
+int readTextGolden(const std::string &path, Particle *out, int capacity) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if(fd < 0)
+    return -1;
+
+  struct stat info;
+  if(fstat(fd, &info) != 0) {
+    close(fd);
+    return -1;
+  }
+  if(info.st_size == 0) {
+    close(fd);
+    return 0;
+  }
+
+  const char *begin = (const char *) mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if(begin == MAP_FAILED)
+    return -1;
+  madvise((void *) begin, info.st_size, MADV_SEQUENTIAL);
+
+  const char *end = begin + info.st_size;
+  int n = 0;
+  for(const char *p = begin; p < end; ) {
+    const char *eol = (const char *) memchr(p, '\n', end - p);
+    if(eol == NULL)
+      eol = end;
+
+    if(eol - p > (long) PARTICLE_PREFIX_LENGTH && memcmp(p, PARTICLE_PREFIX, PARTICLE_PREFIX_LENGTH) == 0) {
+      if(n == capacity || !parseParticle(p + PARTICLE_PREFIX_LENGTH, eol, out[n])) {
+        n = -1;
+        break;
+      }
+      n++;
+    }
+    p = eol + 1;
+  }
+
+  munmap((void *) begin, info.st_size);
+  return n;
+}
+
+int readBinaryGolden(const std::string &path, int numCellsPerDim, int64_t firstRecord, int count, Particle *out) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if(fd < 0)
+    return -1;
+
+  ParticleFileHeader header;
+  std::vector<ParticleRecord> records(count);
+  size_t numBytes = count * sizeof(ParticleRecord);
+  bool ok = pread(fd, &header, sizeof(header), 0) == sizeof(header) &&
+            memcmp(header.magic, "PARTBIN", 8) == 0 &&
+            header.version == PARTICLE_FILE_VERSION &&
+            header.recordSize == sizeof(ParticleRecord) &&
+            header.numCellsPerDim == numCellsPerDim &&
+            firstRecord + count <= header.numParticles &&
+            pread(fd, records.data(), numBytes, sizeof(header) + firstRecord * sizeof(ParticleRecord)) == (ssize_t) numBytes;
+  close(fd);
+  if(!ok)
+    return -1;
+
+  for(int i=0; i<count; i++) {
+    out[i].gid = records[i].gid;
+    out[i].x = records[i].x;
+    out[i].y = records[i].y;
+    out[i].color = records[i].color;
+  }
+  return count;
+}
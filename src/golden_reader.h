@@ -0,0 +1,28 @@
+#ifndef GOLDEN_READER_H
+#define GOLDEN_READER_H
+
+#include <stdint.h>
+#include <string>
+#include "pup_stl.h"
+#include "particle.h"
+
+/*
+*Readers for the precomputed (golden) output used to verify a run.
+*Text goldens are the per-cell sim_output_<x>_<y> files: the file is mapped and
+*every "Particle:gid,x,y,color" line is parsed in place with std::from_chars,
+*straight into the caller's array. Binary goldens are a single particles.bin in
+*the format of the binary output mode (scripts/text_to_particles.py converts a
+*directory of text goldens), from which a cell reads its own records with one
+*pread at its offset.
+*
+*Both readers return the number of particles stored, at most capacity, or -1 if
+*the file cannot be read or does not match.
+*/
+
+// Parse the particle lines of a text golden file into out
+int readTextGolden(const std::string &path, Particle *out, int capacity);
+
+// Read count records starting at firstRecord of a binary golden file into out
+int readBinaryGolden(const std::string &path, int numCellsPerDim, int64_t firstRecord, int count, Particle *out);
+
+#endif
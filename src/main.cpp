@@ -1,5 +1,11 @@
 #include "main.h"
 #include "cell.h"
+#include "aggregator.h"
+#include "cell_map.h"
+#include "snapshot_writer.h"
+#include "perturb_kernel.h"
+#include "particle_distribution.h"
+#include "particle_output.h"
 #include <sys/stat.h>
 #include <iostream>
 #include <fstream>
@@ -7,6 +13,10 @@
 
 /*readonly*/ CProxy_Main mainProxy;
 /*readonly*/ CProxy_Cell cellProxy;
+/*readonly*/ CProxy_SubCell subCellProxy;
+/*readonly*/ CProxy_ParticleAggregator aggregatorProxy;
+/*readonly*/ CProxy_ParticleInbox inboxProxy;
+/*readonly*/ CProxy_SnapshotWriter snapshotProxy;
 /*readonly*/ int particlesPerCell;
 /*readonly*/ int numCellsPerDim;
 /*readonly*/ int iterations;
@@ -17,18 +27,33 @@
 /*readonly*/ double cellDim;
 /*readonly*/ int velocityFactor;
 /*readonly*/ vector<int> particleRatio;
+/*readonly*/ int totalParticlesAllCells;
 /*readonly*/ bool logOutput;
+/*readonly*/ bool binaryOutput;
+/*readonly*/ bool verifyOutput;
+/*readonly*/ int perturbMode;
+/*readonly*/ int rngMode;
+/*readonly*/ bool aggregateExchange;
+/*readonly*/ bool sparseExchange;
+/*readonly*/ bool compressMigrants;
+/*readonly*/ double compressErrorBound;
+/*readonly*/ int streamChunk;
+/*readonly*/ int streamFlush;
+/*readonly*/ int stepsPerExchange;
+/*readonly*/ bool nodeInbox;
+/*readonly*/ bool particleLoad;
+/*readonly*/ int refineThreshold;
+/*readonly*/ int snapshotFreq;
+/*readonly*/ int checkpointFreq;
 
 #if LIVEVIZ_RUN
 /*readonly*/ double pixelScale;
 #endif
 
-CkReduction::reducerType totalOutboundType;
-
-CkReduction::reducerType minMaxType;
+CkReduction::reducerType stepReportType;
 
 Main::Main(CkArgMsg* m) {
-  if(m->argc < 8) CkAbort("USAGE: ./charmrun +p<number_of_processors> ./particle <number of particles per cell> <size of array> <numIterations> <lower, upper, diag, box> <vel-factor> <output-prompt> <load balancing Frequency>");
+  if(m->argc < 8) CkAbort("USAGE: ./charmrun +p<number_of_processors> ./particle <number of particles per cell> <size of array> <numIterations> <lower, upper, diag, box> <vel-factor> <output-prompt> <load balancing Frequency> [--perturb-mode exact|fast] [--rng drand48|philox] [--aggregate] [--sparse] [--compress-migrants] [--compress-error <bound>] [--stream-chunk <particles>] [--stream-flush <particles>] [--steps-per-exchange <k>] [--node-inbox] [--particle-load] [--map default|hilbert|morton] [--refine <particles>] [--output-format text|binary] [--no-verify] [--snapshot-every <iterations>] [--checkpoint-every <iterations>] [--checkpoint-dir <dir>] [--mem-checkpoint]\n       restart: ./charmrun +p<number_of_processors> ./particle +restart <checkpoint dir>");
 
   mainProxy = thisProxy;
   particlesPerCell = atoi(m->argv[1]);
@@ -38,6 +63,7 @@ Main::Main(CkArgMsg* m) {
   velocityFactor = atoi(m->argv[5]);
   string logOutputString(m->argv[6]);
   lbFreq = atoi(m->argv[7]);
+  parseOptions(m->argc - 8, m->argv + 8);
   delete m;
 
   stringstream ss(particleRatioStr);
@@ -67,6 +93,9 @@ Main::Main(CkArgMsg* m) {
 
   cellDim = 1.0;
 
+  // Computed once here in closed form instead of by every cell walking the whole grid
+  totalParticlesAllCells = ParticleDistribution(numCellsPerDim, particlesPerCell, particleRatio).totalParticles();
+
   minParticles = -1;
   maxParticles = -1;
 
@@ -80,6 +109,15 @@ Main::Main(CkArgMsg* m) {
 
   totalParticles = -1;
 
+  lastPhaseReport = 0;
+
+  checkpointIter = 0;
+  checkpointStart = 0.0;
+  elapsedAtCheckpoint = 0.0;
+  checkpointSeconds = 0.0;
+  numCheckpoints = 0;
+  restarted = false;
+
   CkPrintf("================================ Input Params ===============================\n");
   CkPrintf("====================== Particles In A Box Simulation ========================\n");
   CkPrintf("Grid Size                                                  = %d X %d\n", numCellsPerDim, numCellsPerDim);
@@ -91,14 +129,60 @@ Main::Main(CkArgMsg* m) {
   CkPrintf("Red Particles   (Central Box) distribution ratio           = %d\n", particleRatio[3]);
   CkPrintf("Velocity Reduction Factor                                  = %d\n", velocityFactor);
   CkPrintf("Log Output                                                 = %d\n", logOutput);
+  CkPrintf("Output Format                                              = %s\n", binaryOutput ? "binary" : "text");
+  CkPrintf("Verify Output                                              = %d\n", verifyOutput);
   CkPrintf("Load Balancing Frequency                                   = %d\n", lbFreq);
+  CkPrintf("Perturb Mode                                               = %s\n", perturbMode == PERTURB_FAST ? "fast" : "exact");
+  CkPrintf("Random Number Generator                                    = %s\n", rngMode == RNG_PHILOX ? "philox" : "drand48");
+  CkPrintf("Per-PE Message Aggregation                                 = %d\n", aggregateExchange);
+  CkPrintf("Sparse Exchange                                            = %d\n", sparseExchange);
+  if(compressMigrants) {
+    CkPrintf("Compressed Migrants Error Bound                            = %g\n", compressErrorBound);
+  } else {
+    CkPrintf("Compressed Migrants                                        = 0\n");
+  }
+  if(streamChunk > 0) {
+    CkPrintf("Streamed Exchange Chunk / Flush Threshold                  = %d / %d\n", streamChunk, streamFlush);
+  } else {
+    CkPrintf("Streamed Exchange                                          = 0\n");
+  }
+  CkPrintf("Steps Per Exchange                                         = %d\n", stepsPerExchange);
+  CkPrintf("Node-local Inbox Handoff                                   = %d\n", nodeInbox);
+  CkPrintf("Load Balancing On Particle Count                           = %d\n", particleLoad);
+  CkPrintf("Refinement Threshold (0 = off)                             = %d\n", refineThreshold);
+  CkPrintf("Snapshot Frequency (0 = off)                               = %d\n", snapshotFreq);
+  CkPrintf("Checkpoint Frequency (0 = off)                             = %d (%s)\n", checkpointFreq, memCheckpoint ? "in memory" : checkpointDir.c_str());
+  CkPrintf("Cell Map                                                   = %s\n", cellMapMode == CELL_MAP_HILBERT ? "hilbert" : cellMapMode == CELL_MAP_MORTON ? "morton" : "default");
   CkPrintf("=============================================================================\n");
+  if(compressMigrants)
+    reportCompressionBound();
   CkPrintf("======================= Launching Particle Simulation =======================\n");
 
 
+  // One aggregator per PE, used to coalesce the neighbor exchange and to count its messages
+  aggregatorProxy = CProxy_ParticleAggregator::ckNew();
+
+  // One inbox per process, through which cells hand batches to cells in the same process
+  inboxProxy = CProxy_ParticleInbox::ckNew();
+
+  // One snapshot writer per process, each with its own I/O thread
+  if(snapshotFreq > 0) {
+    createDirectory("output");
+    string snapshotDir = "output/" + getDefaultSubdirectoryName() + "_snapshots";
+    createDirectory(snapshotDir);
+    snapshotProxy = CProxy_SnapshotWriter::ckNew(snapshotDir);
+    CkPrintf("Snapshots are written to: %s\n", snapshotDir.c_str());
+  }
+
   //declare a 2D chare array with dimensions numCellsPerDim*numCellsPerDim
   CkArrayOptions opts(numCellsPerDim, numCellsPerDim);
+  if(cellMapMode != CELL_MAP_DEFAULT)
+    opts.setMap(CProxy_CellMap::ckNew(cellMapMode));
   cellProxy = CProxy_Cell::ckNew(opts);
+  reportNeighborLocality();
+
+  // Children of refined cells, inserted on demand
+  subCellProxy = CProxy_SubCell::ckNew();
 
 #if LIVEVIZ_RUN
   pixelScale  = 100.0;
@@ -114,26 +198,279 @@ Main::Main(CkArgMsg* m) {
 }
 
 //function to receive the reduction result
-void Main::receiveTotalOutboundReductionData(CkReductionMsg *data){
-  int *output = (int *) data->getData();
-  //CkAssert(output[2] == particlesPerCell*numCellsPerDim*numCellsPerDim);
-  printTotal(output[0], output[1], output[2]);
-  if(output[2] == iterations) {
+void Main::receiveStepReport(CkReductionMsg *data){
+  StepReport *output = (StepReport *) data->getData();
+  //CkAssert(output->total == particlesPerCell*numCellsPerDim*numCellsPerDim);
+  printTotal(output->total, output->outbound, output->iter);
+  printMinMax(*output);
+  printPhaseTimes(output->phases, output->iter);
+  int iter = output->iter;
+  if(iter == iterations) {
     endTime = CkWallTimer();
 
-    totalParticles = output[0];
+    totalParticles = output->total;
 
     totalTime = (endTime - startTime);
     CkPrintf("======================= Particle Simulation Complete ========================\n");
     CkPrintf("Simulation Complete, total time taken is %lf seconds\n", totalTime);
+    if(numCheckpoints > 0) {
+      CkPrintf("Checkpoints Taken: %d, Checkpoint Time: %lf seconds (%lf seconds each)\n",
+               numCheckpoints, checkpointSeconds, checkpointSeconds/numCheckpoints);
+    }
     CkPrintf("=============================================================================\n");
-#if BONUS_QUESTION
-    // Broadcast everyone to contribute to bonus question reduction
-    cellProxy.contributeToReduction();
-#else
+
+    // Collect the exchange message counters before post-processing
+    aggregatorProxy.reportCounters();
+  }
+}
+
+void Main::receiveExchangeCounters(CkReductionMsg *data) {
+  long *counters = (long *) data->getData();
+  long numMessages = counters[0], numBytes = counters[1], numBatches = counters[2], numHandoffs = counters[3];
+
+  CkPrintf("Exchange Messages Sent: %ld, Bytes Sent: %ld, Particle Batches: %ld (%s)\n",
+           numMessages, numBytes, numBatches, aggregateExchange ? "aggregated per PE" : "direct");
+  if(numMessages > 0) {
+    CkPrintf("Average Batches Per Message: %.2lf, Average Bytes Per Message: %.1lf\n",
+             (double) numBatches/numMessages, (double) numBytes/numMessages);
+  }
+  if(nodeInbox)
+    CkPrintf("Batches Handed Over Within A Node: %ld\n", numHandoffs);
+  delete data;
+
+  // Let the snapshot writers drain their queues before the output is written
+  if(snapshotFreq > 0)
+    snapshotProxy.finish();
+  else
     readyToOutput();
-#endif
+}
+
+// Every cell is waiting at the end of iteration iter, so the state on disk (or in the
+// buddy PE's memory) is consistent
+void Main::startCheckpoint(int iter) {
+  checkpointIter = iter;
+  checkpointStart = CkWallTimer();
+  elapsedAtCheckpoint = checkpointStart - startTime;
+
+  CkCallback cb(CkIndex_Main::checkpointDone(), mainProxy);
+  if(memCheckpoint)
+    CkStartMemCheckpoint(cb);
+  else
+    CkStartCheckpoint(checkpointDir.c_str(), cb);
+}
+
+// Called once the checkpoint is complete, and again after a restart from it
+void Main::checkpointDone() {
+  if(restarted) {
+    restarted = false;
+    // The wall timer starts over in the new processes, so carry over the run time before the checkpoint
+    startTime = CkWallTimer() - elapsedAtCheckpoint;
+    CkPrintf("Restarted from the checkpoint of iteration %d\n", checkpointIter);
+  } else {
+    double seconds = CkWallTimer() - checkpointStart;
+    checkpointSeconds += seconds;
+    numCheckpoints++;
+    CkPrintf("Checkpoint of iteration %d took %.3lf seconds\n", checkpointIter, seconds);
+  }
+
+  cellProxy.resumeFromCheckpoint();
+}
+
+void Main::receiveSnapshotTotals(CkReductionMsg *data) {
+  double *totals = (double *) data->getData();
+  int numSnapshots = iterations / snapshotFreq;
+  CkPrintf("Snapshots Written: %d, Bytes Written: %.0lf, I/O Thread Busy: %.3lf seconds (summed over processes)\n",
+           numSnapshots, totals[0], totals[1]);
+  if(numSnapshots > 0)
+    CkPrintf("Average Bytes Per Snapshot: %.0lf, I/O Thread Busy Per Snapshot: %.3lf seconds\n",
+             totals[0]/numSnapshots, totals[1]/numSnapshots);
+  if(totals[2] > 0)
+    CkPrintf("Cells That Staged While The I/O Thread Was Two Snapshots Behind: %.0lf\n", totals[2]);
+  delete data;
+
+  readyToOutput();
+}
+
+// Print the fraction of the 8-neighbor pairs whose cells start on the same PE and on the same node
+void Main::reportNeighborLocality() {
+  CkArray *cells = cellProxy.ckLocalBranch();
+  vector<int> peOfCell(numCellsPerDim * numCellsPerDim);
+  for(int x=0; x<numCellsPerDim; x++)
+    for(int y=0; y<numCellsPerDim; y++)
+      peOfCell[x*numCellsPerDim + y] = cells->lastKnown(CkArrayIndex2D(x, y));
+
+  long numPairs = 0, onPe = 0, onNode = 0;
+  for(int x=0; x<numCellsPerDim; x++) {
+    for(int y=0; y<numCellsPerDim; y++) {
+      for(int i=-1; i<=1; i++) {
+        for(int j=-1; j<=1; j++) {
+          if(i == 0 && j == 0) continue;
+          int nx = (x + i + numCellsPerDim) % numCellsPerDim;
+          int ny = (y + j + numCellsPerDim) % numCellsPerDim;
+          int pe = peOfCell[x*numCellsPerDim + y], neighborPe = peOfCell[nx*numCellsPerDim + ny];
+          numPairs++;
+          if(pe == neighborPe) onPe++;
+          if(CkNodeOf(pe) == CkNodeOf(neighborPe)) onNode++;
+        }
+      }
+    }
   }
+  CkPrintf("Neighbor pairs on the same PE: %.1lf%%, on the same node: %.1lf%%\n",
+           100.0*onPe/numPairs, 100.0*onNode/numPairs);
+}
+
+// Parse the optional flags that follow the positional arguments
+void Main::parseOptions(int argc, char **argv) {
+  perturbMode = PERTURB_EXACT;
+  rngMode = RNG_DRAND48;
+  aggregateExchange = false;
+  sparseExchange = false;
+  compressMigrants = false;
+  compressErrorBound = 0; // derived from the verification tolerance below unless given
+  streamChunk = 0;
+  streamFlush = 256;
+  stepsPerExchange = 1;
+  nodeInbox = false;
+  particleLoad = false;
+  cellMapMode = CELL_MAP_DEFAULT;
+  refineThreshold = 0;
+  binaryOutput = false;
+  verifyOutput = true;
+  snapshotFreq = 0;
+  checkpointFreq = 0;
+  checkpointDir = "checkpoint";
+  memCheckpoint = false;
+
+  for(int i=0; i<argc; i++) {
+    string option(argv[i]);
+
+    if(option == "--perturb-mode" && i+1 < argc) {
+      string mode(argv[++i]);
+      if(mode == "exact") {
+        perturbMode = PERTURB_EXACT;
+      } else if(mode == "fast") {
+        perturbMode = PERTURB_FAST;
+      } else {
+        CkAbort("Perturb mode incorrect! Pass either \"exact\" or \"fast\"");
+      }
+    } else if(option == "--rng" && i+1 < argc) {
+      string rng(argv[++i]);
+      if(rng == "drand48") {
+        rngMode = RNG_DRAND48;
+      } else if(rng == "philox") {
+        rngMode = RNG_PHILOX;
+      } else {
+        CkAbort("Random number generator incorrect! Pass either \"drand48\" or \"philox\"");
+      }
+    } else if(option == "--aggregate") {
+      aggregateExchange = true;
+    } else if(option == "--sparse") {
+      sparseExchange = true;
+    } else if(option == "--compress-migrants") {
+      compressMigrants = true;
+    } else if(option == "--compress-error" && i+1 < argc) {
+      compressMigrants = true;
+      compressErrorBound = atof(argv[++i]);
+      // Quantization errors feed back into the following steps, so keep the bound well below
+      // the verification tolerance
+      if(compressErrorBound <= 0 || compressErrorBound >= VERIFY_TOLERANCE)
+        CkAbort("Compression error bound incorrect! Pass a value in (0, 1e-6)");
+    } else if(option == "--stream-chunk" && i+1 < argc) {
+      streamChunk = atoi(argv[++i]);
+      if(streamChunk <= 0)
+        CkAbort("Stream chunk size incorrect! Pass a positive number of particles");
+    } else if(option == "--stream-flush" && i+1 < argc) {
+      streamFlush = atoi(argv[++i]);
+      if(streamFlush <= 0)
+        CkAbort("Stream flush threshold incorrect! Pass a positive number of particles");
+    } else if(option == "--steps-per-exchange" && i+1 < argc) {
+      stepsPerExchange = atoi(argv[++i]);
+      if(stepsPerExchange <= 0)
+        CkAbort("Steps per exchange incorrect! Pass a positive number of iterations");
+    } else if(option == "--node-inbox") {
+      nodeInbox = true;
+    } else if(option == "--particle-load") {
+      particleLoad = true;
+    } else if(option == "--map" && i+1 < argc) {
+      string map(argv[++i]);
+      if(map == "default") {
+        cellMapMode = CELL_MAP_DEFAULT;
+      } else if(map == "hilbert") {
+        cellMapMode = CELL_MAP_HILBERT;
+      } else if(map == "morton") {
+        cellMapMode = CELL_MAP_MORTON;
+      } else {
+        CkAbort("Cell map incorrect! Pass either \"default\", \"hilbert\" or \"morton\"");
+      }
+    } else if(option == "--refine" && i+1 < argc) {
+      refineThreshold = atoi(argv[++i]);
+      if(refineThreshold <= 0)
+        CkAbort("Refinement threshold incorrect! Pass a positive number of particles");
+    } else if(option == "--output-format" && i+1 < argc) {
+      string format(argv[++i]);
+      if(format == "text") {
+        binaryOutput = false;
+      } else if(format == "binary") {
+        binaryOutput = true;
+      } else {
+        CkAbort("Output format incorrect! Pass either \"text\" or \"binary\"");
+      }
+    } else if(option == "--no-verify") {
+      // Only the grids of scripts/compareOutput have precomputed output to compare against
+      verifyOutput = false;
+    } else if(option == "--snapshot-every" && i+1 < argc) {
+      snapshotFreq = atoi(argv[++i]);
+      if(snapshotFreq <= 0)
+        CkAbort("Snapshot frequency incorrect! Pass a positive number of iterations");
+    } else if(option == "--checkpoint-every" && i+1 < argc) {
+      checkpointFreq = atoi(argv[++i]);
+      if(checkpointFreq <= 0)
+        CkAbort("Checkpoint frequency incorrect! Pass a positive number of iterations");
+    } else if(option == "--checkpoint-dir" && i+1 < argc) {
+      checkpointDir = argv[++i];
+    } else if(option == "--mem-checkpoint") {
+      memCheckpoint = true;
+    } else {
+      CkAbort("Unknown option %s", option.c_str());
+    }
+  }
+
+  // The aggregator only sends once every local cell is done, which defeats streaming
+  if(streamChunk > 0 && aggregateExchange)
+    CkAbort("--stream-chunk cannot be combined with --aggregate");
+
+  // Streaming only knows the 8 immediate neighbors
+  if(streamChunk > 0 && stepsPerExchange > 1)
+    CkAbort("--stream-chunk cannot be combined with --steps-per-exchange");
+
+  // Children take exactly one step per iteration
+  if(refineThreshold > 0 && (streamChunk > 0 || stepsPerExchange > 1))
+    CkAbort("--refine cannot be combined with --stream-chunk or --steps-per-exchange");
+
+  // The particles of a refined cell live in its children
+  if(refineThreshold > 0 && snapshotFreq > 0)
+    CkAbort("--snapshot-every cannot be combined with --refine");
+
+  // By default quantize migrants as coarsely as still passes verification after the last
+  // exchange, which a particle may have migrated in every time
+  if(compressMigrants && compressErrorBound == 0)
+    compressErrorBound = migrationErrorBound(VERIFY_TOLERANCE, numExchanges());
+}
+
+// Exchanges in a run: every stepsPerExchange-th iteration and the last one
+int Main::numExchanges() {
+  return (iterations + stepsPerExchange - 1)/stepsPerExchange;
+}
+
+// Say when the compression error bound sends exact positions or may fail verification
+void Main::reportCompressionBound() {
+  if(ParticleCodec(cellDim, compressErrorBound).exactPositions())
+    CkPrintf("Note: an error bound of %g is finer than migrants can be quantized to, so their positions are sent exact\n", compressErrorBound);
+
+  double worstError = compressErrorBound * numExchanges();
+  if(verifyOutput && worstError >= VERIFY_TOLERANCE)
+    CkPrintf("Warning: %d exchanges with an error bound of %g can move particles by %g, beyond the verification tolerance of %g; pass --compress-error %g or less\n",
+             numExchanges(), compressErrorBound, worstError, VERIFY_TOLERANCE, migrationErrorBound(VERIFY_TOLERANCE, numExchanges()));
 }
 
 bool Main::getUserInput() {
@@ -152,6 +489,15 @@ bool Main::getUserInput() {
   }
 }
 
+// Create a directory unless it already exists
+void Main::createDirectory(const string &path) {
+  struct stat info;
+  if(stat(path.c_str(), &info) == 0)
+    return;
+  if(mkdir(path.c_str(), S_IRWXU | S_IRWXG | S_IROTH | S_IXOTH) == -1)
+    CmiAbort("Error while creating the directory %s", path.c_str());
+}
+
 string Main::getDefaultSubdirectoryName() {
   char runOutputFolder[80];
   struct timeval tv;
@@ -209,10 +555,21 @@ void Main::readyToOutput() {
     myFile << "Input:Velocity Factor:" << velocityFactor << endl;
     myFile << "Output:Total Time:" << totalTime << endl;
     myFile << "Output:Time Per Step:" << totalTime/iterations << endl;
+    myFile << "Output:Checkpoints:" << numCheckpoints << endl;
+    myFile << "Output:Checkpoint Time:" << checkpointSeconds << endl;
     myFile << "Output:Max Particles:" << maxParticles << endl;
     myFile << "Output:Cell with Max Particles:" << "(" << maxCellX << "," << maxCellY << ")" << endl;
     myFile << "Output:Min Particles:" << minParticles << endl;
     myFile << "Output:Cell with Min Particles:" << "(" << minCellX << "," << minCellY << ")" << endl;
+    // One line per phase and report: iteration, then min, avg and max seconds per step and the cell with the max
+    for(int r=0; r<phaseReportIters.size(); r++) {
+      for(int p=0; p<NUM_PHASES; p++) {
+        const PhaseStat &stat = phaseHistory[r*NUM_PHASES + p];
+        myFile << "Output:Phase Time " << phaseName(p) << ":" << phaseReportIters[r] << ",";
+        myFile << stat.min << "," << stat.sum/stat.numCells << "," << stat.max << ",";
+        myFile << "(" << stat.maxCell / numCellsPerDim << "," << stat.maxCell % numCellsPerDim << ")" << endl;
+      }
+    }
     myFile << "====================================== END ==========================================" << endl;
   } else {
     CmiAbort("Error while opening the file for writing main output");
@@ -228,17 +585,30 @@ void Main::readyToOutput() {
   CkPrintf("Exiting program\n");
   CkExit();
 #else
+  // Cells write their records at fixed offsets of a file created here, before any cell gets to it
+  if(logOutput && binaryOutput)
+    createParticleFile(finalPath + "/" PARTICLE_FILE_NAME, numCellsPerDim, totalParticlesAllCells);
+
   // Ask every cell to send the particles to the right home based on the global index
   cellProxy.reorganizeParticles(finalPath);
+
+  // Normally every cell completes and done() exits first; quiescence before that means particles were lost
+  CkStartQD(CkCallback(CkIndex_Main::reorganizationQuiescent(), mainProxy));
 #endif
 }
 
+void Main::reorganizationQuiescent() {
+  cellProxy.checkReorganization();
+}
+
 void Main::done() {
   CkPrintf("=============================================================================\n");
   CkPrintf("Success! Simulation correctness verified across all cells\n");
   CkPrintf("=============================================================================\n");
   CkPrintf("Final summarized output has been written to: %s/sim_output_main\n", finalPath.c_str());
-  if(logOutput) {
+  if(logOutput && binaryOutput) {
+    CkPrintf("All particle output has been written to : %s/%s (convert with scripts/particles_to_text.py)\n", finalPath.c_str(), PARTICLE_FILE_NAME);
+  } else if(logOutput) {
     CkPrintf("All particle output has been written to files in directory : %s\n", finalPath.c_str());
   }
   CkPrintf("Exiting program\n");
@@ -246,40 +616,62 @@ void Main::done() {
 }
 
 // and max counts and exiting when the iterations are done
-void Main::printTotal(int total, int max, int iter){
-  CkPrintf("Iteration: %d, Outgoing Particles Sum: %d, Total Particles: %d\n", iter, max, total);
+void Main::printTotal(long long total, long long outbound, int iter){
+  CkPrintf("Iteration: %d, Outgoing Particles Sum: %lld, Total Particles: %lld\n", iter, outbound, total);
 }
 
-// Global Functions
-CkReductionMsg *calculateTotalAndOutbound(int nMsg, CkReductionMsg **msgs) {
-  int returnVal[3];
-
-  //signifies total particles sum value
-  returnVal[0]=0;
-
-  //signifies outgoing particles sum value
-  returnVal[1]=0;
-
-  for (int i=0;i<nMsg;i++) {
-    CkAssert(msgs[i]->getSize()==3*sizeof(int));
-    int *m=(int *)msgs[i]->getData();
-
-    returnVal[0]+=m[0]; // Sum of total particles
-
-    returnVal[1]+=m[1]; // Sum of outbound particles
+// Print the most and least loaded cells and keep them; the last report, at the final
+// iteration, is the one written to sim_output_main
+void Main::printMinMax(const StepReport &report) {
+  maxParticles = report.maxParticles;
+  maxCellX = report.maxCellX;
+  maxCellY = report.maxCellY;
+  minParticles = report.minParticles;
+  minCellX = report.minCellX;
+  minCellY = report.minCellY;
+
+  double average = (double) report.total / (numCellsPerDim * numCellsPerDim);
+  CkPrintf("  Max Particles: %d in cell (%d, %d), Min Particles: %d in cell (%d, %d), Max/Avg: %.2lf\n",
+           maxParticles, maxCellX, maxCellY, minParticles, minCellX, minCellY,
+           average > 0 ? maxParticles / average : 0.0);
+}
 
-    returnVal[2]=m[2];
+// Print min/avg/max per step of every phase since the previous report, with the
+// cell holding the max, and keep them for sim_output_main
+void Main::printPhaseTimes(const PhaseStat *phases, int iter) {
+  int numSteps = iter - lastPhaseReport;
+  lastPhaseReport = iter;
+
+  for(int p=0; p<NUM_PHASES; p++) {
+    PhaseStat stat = phases[p];
+    stat.min /= numSteps;
+    stat.sum /= numSteps;
+    stat.max /= numSteps;
+    phaseHistory.push_back(stat);
+
+    CkPrintf("  Phase %-8s ms/step min: %.3lf, avg: %.3lf, max: %.3lf on cell (%d, %d)\n", phaseName(p),
+             1e3*stat.min, 1e3*stat.sum/stat.numCells, 1e3*stat.max,
+             stat.maxCell / numCellsPerDim, stat.maxCell % numCellsPerDim);
   }
-  return CkReductionMsg::buildNew(3*sizeof(int),returnVal);
+  phaseReportIters.push_back(iter);
 }
 
-CkReductionMsg *calculateMaxMin(int nMsg, CkReductionMsg **msgs);
+// Global Functions
+// Sums, max/min with their cells and phase times in a single pass; the contributions
+// are only read, and the result is built in a new message
+CkReductionMsg *calculateStepReport(int nMsg, CkReductionMsg **msgs) {
+  CkAssert(msgs[0]->getSize()==sizeof(StepReport));
+  StepReport returnVal = *(StepReport *)msgs[0]->getData();
+
+  for (int i=1;i<nMsg;i++) {
+    CkAssert(msgs[i]->getSize()==sizeof(StepReport));
+    combineStepReports(returnVal, *(const StepReport *)msgs[i]->getData());
+  }
+  return CkReductionMsg::buildNew(sizeof(StepReport),&returnVal);
+}
 
-void registerCalculateTotalAndOutbound(void){
-  totalOutboundType = CkReduction::addReducer(calculateTotalAndOutbound);
-#if BONUS_QUESTION
-  minMaxType = CkReduction::addReducer(calculateMaxMin);
-#endif
+void registerStepReportReducer(void){
+  stepReportType = CkReduction::addReducer(calculateStepReport);
 }
 
 #include "particleSimulation.def.h"
@@ -1,6 +1,7 @@
 #ifndef MAIN_H
 #define MAIN_H
 #include <string>
+#include <vector>
 #include <assert.h>
 using namespace std;
 
@@ -10,6 +11,7 @@ using namespace std;
 
 #include "particleSimulation.decl.h"
 #include "custom_rand_gen.h"
+#include "step_report.h"
 
 #define PIXEL_SCALE (8)
 
@@ -22,26 +24,77 @@ class Main: public CBase_Main {
   int minCellX, minCellY;
   int maxCellX, maxCellY;
 
-  int totalParticles;
+  long long totalParticles;
   string finalPath;
 
+  int cellMapMode;
+
+  // per-step phase times of every report, NUM_PHASES per iteration in phaseReportIters
+  vector<PhaseStat> phaseHistory;
+  vector<int> phaseReportIters;
+  int lastPhaseReport;
+
+  // checkpointing: target directory, in-memory instead of disk, iteration and start
+  // time of the last checkpoint, run time before it, and the time spent checkpointing
+  string checkpointDir;
+  bool memCheckpoint;
+  int checkpointIter;
+  double checkpointStart, elapsedAtCheckpoint;
+  double checkpointSeconds;
+  int numCheckpoints;
+  bool restarted;
+
   public:
     Main(CkArgMsg* m);
+    Main(CkMigrateMessage* m) : CBase_Main(m) {}
+
+    void pup(PUP::er &p) {
+      CBase_Main::pup(p);
+      p | startTime;
+      p | endTime;
+      p | totalTime;
+      p | minParticles;
+      p | maxParticles;
+      p | minCellX;
+      p | minCellY;
+      p | maxCellX;
+      p | maxCellY;
+      p | totalParticles;
+      p | finalPath;
+      p | cellMapMode;
+      p | phaseHistory;
+      p | phaseReportIters;
+      p | lastPhaseReport;
+      p | checkpointDir;
+      p | memCheckpoint;
+      p | checkpointIter;
+      p | checkpointStart;
+      p | elapsedAtCheckpoint;
+      p | checkpointSeconds;
+      p | numCheckpoints;
+      restarted = p.isUnpacking();
+    }
 
     //function to receive the reduction result
-    void receiveTotalOutboundReductionData(CkReductionMsg *data);
+    void receiveStepReport(CkReductionMsg *data);
     void done();
-    void printTotal(int total, int max, int iter);
+    void receiveExchangeCounters(CkReductionMsg *data);
+    void receiveSnapshotTotals(CkReductionMsg *data);
+    void startCheckpoint(int iter);
+    void checkpointDone();
+    void reorganizationQuiescent();
+    void printTotal(long long total, long long outbound, int iter);
+    void printMinMax(const StepReport &report);
+    void printPhaseTimes(const PhaseStat *phases, int iter);
 
     void readyToOutput();
     bool getUserInput();
+    void parseOptions(int argc, char **argv);
+    int numExchanges();
+    void reportCompressionBound();
     string getDefaultSubdirectoryName();
-
-#if BONUS_QUESTION
-    void computeMin(int min);
-    void computeMax(int max);
-    void receiveMinMaxReductionData(CkReductionMsg *data);
-#endif
+    void createDirectory(const string &path);
+    void reportNeighborLocality();
 };
 
 #endif
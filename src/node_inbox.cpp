@@ -0,0 +1,36 @@
+#include "node_inbox.h"
+
+extern int numCellsPerDim;
+
+ParticleInbox::ParticleInbox() {
+  allocate();
+}
+
+void ParticleInbox::allocate() {
+  numCells = numCellsPerDim * numCellsPerDim;
+  inbox = new std::atomic<InboxBatch *>[numCells];
+  spares = new std::atomic<InboxBatch *>[numCells];
+  resident = new std::atomic<char>[numCells];
+
+  for(int i=0; i<numCells; i++) {
+    inbox[i].store(NULL, std::memory_order_relaxed);
+    spares[i].store(NULL, std::memory_order_relaxed);
+    resident[i].store(false, std::memory_order_relaxed);
+  }
+}
+
+ParticleInbox::~ParticleInbox() {
+  for(int i=0; i<numCells; i++) {
+    for(InboxBatch *batch = takeAll(inbox[i]), *next; batch != NULL; batch = next) {
+      next = batch->next;
+      delete batch;
+    }
+    for(InboxBatch *batch = takeAll(spares[i]), *next; batch != NULL; batch = next) {
+      next = batch->next;
+      delete batch;
+    }
+  }
+  delete [] inbox;
+  delete [] spares;
+  delete [] resident;
+}
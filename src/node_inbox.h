@@ -0,0 +1,66 @@
+#ifndef NODE_INBOX_H
+#define NODE_INBOX_H
+
+#include <atomic>
+#include "particle_array.h"
+
+#include "particleSimulation.decl.h"
+
+/*
+*Node-local handoff of neighbor batches.
+*When the destination of a batch lives in the same process, the sender swaps its
+*outgoing buffer into an InboxBatch and pushes it onto the destination's inbox, and
+*only a small notice goes through the message path. The receiver takes its whole
+*inbox at once, appends the batches of the current iteration and returns the
+*emptied batches, which keep their capacity, to the sender's spare list.
+*
+*Both lists are only ever pushed with a CAS or emptied with an exchange, so they
+*are lock-free without an ABA problem. Cells only migrate between exchanges, so
+*the resident flags are stable while batches are in flight.
+*/
+
+struct InboxBatch {
+    int iter;
+    int senderX, senderY;
+    int numBatches;        // as in ParticleMsg
+    ParticleArray particles;
+    InboxBatch *next;
+};
+
+class ParticleInbox : public CBase_ParticleInbox {
+  int numCells;
+  std::atomic<InboxBatch *> *inbox;   // batches waiting for each cell
+  std::atomic<InboxBatch *> *spares;  // emptied batches returned to each sending cell
+  std::atomic<char> *resident;        // whether each cell lives in this process
+
+  static void push(std::atomic<InboxBatch *> &head, InboxBatch *batch) {
+    InboxBatch *top = head.load(std::memory_order_relaxed);
+    do {
+      batch->next = top;
+    } while(!head.compare_exchange_weak(top, batch, std::memory_order_release, std::memory_order_relaxed));
+  }
+
+  static InboxBatch *takeAll(std::atomic<InboxBatch *> &head) {
+    return head.exchange(NULL, std::memory_order_acquire);
+  }
+
+  void allocate();
+
+  public:
+    ParticleInbox();
+    // Nothing is saved in a checkpoint: the lists are empty between iterations and
+    // restored cells mark themselves resident again
+    ParticleInbox(CkMigrateMessage *m) : CBase_ParticleInbox(m) { allocate(); }
+    ~ParticleInbox();
+
+    void setResident(int cell, bool isResident) { resident[cell].store(isResident, std::memory_order_relaxed); }
+    bool isResident(int cell) const { return resident[cell].load(std::memory_order_relaxed); }
+
+    void deliver(int cell, InboxBatch *batch) { push(inbox[cell], batch); }
+    InboxBatch *collect(int cell) { return takeAll(inbox[cell]); }
+
+    void returnSpare(int cell, InboxBatch *batch) { push(spares[cell], batch); }
+    InboxBatch *collectSpares(int cell) { return takeAll(spares[cell]); }
+};
+
+#endif
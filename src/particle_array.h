@@ -0,0 +1,102 @@
+#ifndef PARTICLE_ARRAY_H
+#define PARTICLE_ARRAY_H
+
+#include <vector>
+#include "pup_stl.h"
+#include "particle.h"
+
+/*
+*Structure-of-arrays storage for the particles of a cell.
+*The attributes of particle i live at index i of gid, x, y and color, so loops
+*that only touch the coordinates stream through contiguous doubles.
+*/
+
+class ParticleArray {
+public:
+    std::vector<int> gid;      // unique global particle ids
+    std::vector<double> x;     // x coordinates
+    std::vector<double> y;     // y coordinates
+    std::vector<char> color;   // colors
+
+    int size() const { return gid.size(); }
+    bool empty() const { return gid.empty(); }
+
+    void clear() {
+      gid.clear();
+      x.clear();
+      y.clear();
+      color.clear();
+    }
+
+    void reserve(int n) {
+      gid.reserve(n);
+      x.reserve(n);
+      y.reserve(n);
+      color.reserve(n);
+    }
+
+    void resize(int n) {
+      gid.resize(n);
+      x.resize(n);
+      y.resize(n);
+      color.resize(n);
+    }
+
+    void push_back(const Particle &p) {
+      gid.push_back(p.gid);
+      x.push_back(p.x);
+      y.push_back(p.y);
+      color.push_back(p.color);
+    }
+
+    // append particle i of another array
+    void push_back(const ParticleArray &src, int i) {
+      gid.push_back(src.gid[i]);
+      x.push_back(src.x[i]);
+      y.push_back(src.y[i]);
+      color.push_back(src.color[i]);
+    }
+
+    // append n particles given as separate attribute arrays
+    void append(const int *srcGid, const double *srcX, const double *srcY, const char *srcColor, int n) {
+      gid.insert(gid.end(), srcGid, srcGid + n);
+      x.insert(x.end(), srcX, srcX + n);
+      y.insert(y.end(), srcY, srcY + n);
+      color.insert(color.end(), srcColor, srcColor + n);
+    }
+
+    void append(const std::vector<Particle> &incoming) {
+      reserve(size() + incoming.size());
+      for(int i=0; i<incoming.size(); i++)
+        push_back(incoming[i]);
+    }
+
+    Particle get(int i) const {
+      return Particle(x[i], y[i], color[i], gid[i]);
+    }
+
+    // overwrite particle dst with particle src
+    void copy(int dst, int src) {
+      gid[dst] = gid[src];
+      x[dst] = x[src];
+      y[dst] = y[src];
+      color[dst] = color[src];
+    }
+
+    // exchange contents (and capacity) with another array without copying
+    void swap(ParticleArray &other) {
+      gid.swap(other.gid);
+      x.swap(other.x);
+      y.swap(other.y);
+      color.swap(other.color);
+    }
+
+    void pup(PUP::er &p){
+      p|gid;
+      p|x;
+      p|y;
+      p|color;
+    }
+};
+
+#endif
@@ -0,0 +1,185 @@
+#include "particle_codec.h"
+#include <algorithm>
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+
+// Largest quantization width: with finer steps the rounding of origin + q*step
+// (about 1e-13 on a grid of a thousand cells) is no longer small against the bound
+#define MAX_POSITION_BITS 36
+
+// Writes values of up to 56 bits into a little-endian bit stream
+class BitWriter {
+  unsigned char *out;
+  uint64_t acc;
+  int numBits;
+
+  public:
+    BitWriter(char *out) : out((unsigned char *) out), acc(0), numBits(0) {}
+
+    void put(uint64_t value, int bits) {
+      acc |= value << numBits;
+      numBits += bits;
+      while(numBits >= 8) {
+        *out++ = acc & 0xff;
+        acc >>= 8;
+        numBits -= 8;
+      }
+    }
+
+    // Flush the last partial byte and return the end of the stream
+    char *finish() {
+      if(numBits > 0)
+        *out++ = acc & 0xff;
+      acc = 0;
+      numBits = 0;
+      return (char *) out;
+    }
+};
+
+class BitReader {
+  const unsigned char *in;
+  uint64_t acc;
+  int numBits;
+
+  public:
+    BitReader(const char *in) : in((const unsigned char *) in), acc(0), numBits(0) {}
+
+    uint64_t get(int bits) {
+      while(numBits < bits) {
+        acc |= (uint64_t) *in++ << numBits;
+        numBits += 8;
+      }
+      uint64_t value = acc & ((UINT64_C(1) << bits) - 1);
+      acc >>= bits;
+      numBits -= bits;
+      return value;
+    }
+
+    const char *position() const { return (const char *) in; }
+};
+
+double migrationErrorBound(double tolerance, int numMigrations) {
+  return tolerance / (numMigrations > 0 ? numMigrations : 1);
+}
+
+ParticleCodec::ParticleCodec(double cellDim, double errorBound) {
+  // The smallest width whose step, cellDim/(2^bits - 1), is at most 2*errorBound
+  positionBits = 1;
+  while(positionBits <= MAX_POSITION_BITS && cellDim/(ldexp(1.0, positionBits) - 1) > 2*errorBound)
+    positionBits++;
+
+  if(positionBits > MAX_POSITION_BITS) {
+    positionBits = EXACT_POSITION_BITS;
+    step = 0;
+  } else {
+    step = cellDim/(ldexp(1.0, positionBits) - 1);
+  }
+}
+
+int ParticleCodec::maxEncodedSize(int n) const {
+  // a gid delta takes at most 5 varint bytes
+  return sizeof(PackedHeader) + 5*n + (2*positionBits*n + 7)/8 + n;
+}
+
+int ParticleCodec::encode(const ParticleArray &batch, double originX, double originY, char *out, std::vector<int> &order) const {
+  int n = batch.size();
+
+  order.resize(n);
+  for(int i=0; i<n; i++)
+    order[i] = i;
+  std::sort(order.begin(), order.end(), [&batch](int a, int b) { return batch.gid[a] < batch.gid[b]; });
+
+  // value-initialized so that its padding goes out as zeros
+  PackedHeader header = {};
+  header.numParticles = n;
+  header.positionBits = positionBits;
+  header.firstGid = n > 0 ? batch.gid[order[0]] : 0;
+  header.originX = originX;
+  header.originY = originY;
+  header.step = step;
+  memcpy(out, &header, sizeof(PackedHeader));
+
+  unsigned char *gids = (unsigned char *) out + sizeof(PackedHeader);
+  int prevGid = header.firstGid;
+  for(int i=0; i<n; i++) {
+    uint32_t delta = batch.gid[order[i]] - prevGid;
+    prevGid = batch.gid[order[i]];
+    while(delta >= 0x80) {
+      *gids++ = (delta & 0x7f) | 0x80;
+      delta >>= 7;
+    }
+    *gids++ = delta;
+  }
+
+  char *colors;
+  if(exactPositions()) {
+    colors = (char *) gids;
+    for(int i=0; i<n; i++) {
+      memcpy(colors, &batch.x[order[i]], sizeof(double));
+      memcpy(colors + sizeof(double), &batch.y[order[i]], sizeof(double));
+      colors += 2*sizeof(double);
+    }
+  } else {
+    const double maxCode = ldexp(1.0, positionBits) - 1;
+    BitWriter positions((char *) gids);
+    for(int i=0; i<n; i++) {
+      double qx = floor((batch.x[order[i]] - originX)/step + 0.5);
+      double qy = floor((batch.y[order[i]] - originY)/step + 0.5);
+      positions.put((uint64_t) std::min(std::max(qx, 0.0), maxCode), positionBits);
+      positions.put((uint64_t) std::min(std::max(qy, 0.0), maxCode), positionBits);
+    }
+    colors = positions.finish();
+  }
+
+  for(int i=0; i<n; i++)
+    *colors++ = batch.color[order[i]];
+
+  return colors - out;
+}
+
+int ParticleCodec::decodedCount(const char *in) {
+  PackedHeader header;
+  memcpy(&header, in, sizeof(PackedHeader));
+  return header.numParticles;
+}
+
+void ParticleCodec::decode(const char *in, ParticleArray &out) {
+  PackedHeader header;
+  memcpy(&header, in, sizeof(PackedHeader));
+  int n = header.numParticles;
+  int first = out.size();
+  out.resize(first + n);
+
+  const unsigned char *gids = (const unsigned char *) in + sizeof(PackedHeader);
+  int gid = header.firstGid;
+  for(int i=0; i<n; i++) {
+    uint32_t delta = 0;
+    int shift = 0;
+    while(*gids & 0x80) {
+      delta |= (uint32_t) (*gids++ & 0x7f) << shift;
+      shift += 7;
+    }
+    delta |= (uint32_t) *gids++ << shift;
+    gid += delta;
+    out.gid[first + i] = gid;
+  }
+
+  const char *colors;
+  if(header.positionBits == EXACT_POSITION_BITS) {
+    colors = (const char *) gids;
+    for(int i=0; i<n; i++) {
+      memcpy(&out.x[first + i], colors, sizeof(double));
+      memcpy(&out.y[first + i], colors + sizeof(double), sizeof(double));
+      colors += 2*sizeof(double);
+    }
+  } else {
+    BitReader positions((const char *) gids);
+    for(int i=0; i<n; i++) {
+      out.x[first + i] = header.originX + positions.get(header.positionBits)*header.step;
+      out.y[first + i] = header.originY + positions.get(header.positionBits)*header.step;
+    }
+    colors = positions.position();
+  }
+  memcpy(out.color.data() + first, colors, n);
+}
@@ -0,0 +1,59 @@
+#ifndef PARTICLE_CODEC_H
+#define PARTICLE_CODEC_H
+
+#include <vector>
+#include "particle_array.h"
+
+/*
+*Compact encoding of a batch of migrating particles.
+*
+*A migrant always lands in a known 1x1 destination cell, so each coordinate is sent
+*as an unsigned integer offset from that cell's origin, quantized with a step chosen
+*so that the decoding error stays within a given bound. A bound finer than the
+*widest quantization can honor sends the coordinates as exact doubles instead. The
+*batch is sorted by gid and the gids are sent as varint deltas. Encoded layout:
+*
+*  PackedHeader | gid deltas (LEB128) | bit-packed (qx, qy) pairs or (x, y) doubles | colors
+*/
+
+struct PackedHeader {
+    int numParticles;
+    int positionBits;   // bits per quantized coordinate, or EXACT_POSITION_BITS
+    int firstGid;
+    double originX, originY;
+    double step;        // coordinate = origin + q * step
+};
+
+// positionBits of a batch whose coordinates are sent as exact doubles
+#define EXACT_POSITION_BITS 64
+
+// Largest error bound per migration that keeps the accumulated position error below
+// tolerance: every migration re-quantizes the position once, so the errors of at most
+// numMigrations migrations add up
+double migrationErrorBound(double tolerance, int numMigrations);
+
+class ParticleCodec {
+  int positionBits;
+  double step;
+
+  public:
+    // Quantize offsets in [0, cellDim] with an absolute error of at most errorBound
+    ParticleCodec(double cellDim, double errorBound);
+
+    int getPositionBits() const { return positionBits; }
+    bool exactPositions() const { return positionBits == EXACT_POSITION_BITS; }
+
+    // Upper bound on the encoded size of a batch of n particles
+    int maxEncodedSize(int n) const;
+
+    // Encode batch relative to the origin of the destination cell into out (of at
+    // least maxEncodedSize bytes); order is scratch space. Returns the encoded size.
+    int encode(const ParticleArray &batch, double originX, double originY, char *out, std::vector<int> &order) const;
+
+    static int decodedCount(const char *in);
+
+    // Append the particles of an encoded batch to out
+    static void decode(const char *in, ParticleArray &out);
+};
+
+#endif
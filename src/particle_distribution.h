@@ -0,0 +1,69 @@
+#ifndef PARTICLE_DISTRIBUTION_H
+#define PARTICLE_DISTRIBUTION_H
+
+#include <vector>
+
+/*
+*Closed-form description of the initial particle distribution.
+*Cells below the diagonal get green particles, cells above it blue ones, diagonal cells
+*red ones, and the cells of the central box (numCellsPerDim/4 cells wide) extra red ones.
+*Global ids are assigned cell by cell, iterating over x within each y.
+*/
+
+class ParticleDistribution {
+  int numCellsPerDim;
+  int perGreenCell, perBlueCell, perDiagCell, perBoxCell;
+  int boxMin, boxWidth;
+
+  static int clampedOverlap(int begin, int end, int lo, int hi) {
+    int overlap = (end < hi ? end : hi) - (begin > lo ? begin : lo);
+    return overlap > 0 ? overlap : 0;
+  }
+
+public:
+  ParticleDistribution(int numCellsPerDim, int particlesPerCell, const std::vector<int> &particleRatio) {
+    this->numCellsPerDim = numCellsPerDim;
+    perGreenCell = particleRatio[0] * particlesPerCell;
+    perBlueCell = particleRatio[1] * particlesPerCell;
+    perDiagCell = particleRatio[2] * particlesPerCell;
+    perBoxCell = particleRatio[3] * particlesPerCell;
+    boxWidth = numCellsPerDim/4;
+    boxMin = (numCellsPerDim - boxWidth)/2;
+  }
+
+  bool inCentralBox(int cellX, int cellY) const {
+    return cellX >= boxMin && cellX < boxMin + boxWidth && cellY >= boxMin && cellY < boxMin + boxWidth;
+  }
+
+  // number of particles initially placed in cell (cellX, cellY)
+  int particlesInCell(int cellX, int cellY) const {
+    int n = cellX < cellY ? perGreenCell : cellX > cellY ? perBlueCell : perDiagCell;
+    if(inCentralBox(cellX, cellY))
+      n += perBoxCell;
+    return n;
+  }
+
+  // number of particles in all cells that precede (cellX, cellY), i.e. its first gid - 1
+  int particlesBeforeCell(int cellX, int cellY) const {
+    // complete rows 0 .. cellY-1
+    int green = cellY * (cellY - 1)/2;
+    int blue = cellY * (numCellsPerDim - 1) - green;
+    int diag = cellY;
+    int box = clampedOverlap(0, cellY, boxMin, boxMin + boxWidth) * boxWidth;
+
+    // cells 0 .. cellX-1 of row cellY
+    green += cellX < cellY ? cellX : cellY;
+    blue += cellX > cellY + 1 ? cellX - cellY - 1 : 0;
+    diag += cellX > cellY ? 1 : 0;
+    if(cellY >= boxMin && cellY < boxMin + boxWidth)
+      box += clampedOverlap(0, cellX, boxMin, boxMin + boxWidth);
+
+    return green * perGreenCell + blue * perBlueCell + diag * perDiagCell + box * perBoxCell;
+  }
+
+  int totalParticles() const {
+    return particlesBeforeCell(0, numCellsPerDim);
+  }
+};
+
+#endif
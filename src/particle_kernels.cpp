@@ -0,0 +1,116 @@
+#include "particle_kernels.h"
+#include <algorithm>
+
+// Partition particles in place: a particle that leaves the cell is copied into
+// the buffer of its destination neighbor and replaced by the last particle of
+// the arrays, so nothing is erased from the middle and the buffers (which keep
+// their capacity across iterations) stop allocating once they are warm.
+void partitionParticles(ParticleArray &particles, double startX, double endX, double startY, double endY, ParticleArray *outgoing) {
+  const double *x = particles.x.data();
+  const double *y = particles.y.data();
+
+  int numRemaining = particles.size();
+  int p = 0;
+  while (p < numRemaining) {
+    int dirX = 0, dirY = 0;
+    if (x[p] < startX) dirX = -1;
+    else if (x[p] > endX) dirX = 1;
+
+    if (y[p] < startY) dirY = -1;
+    else if (y[p] > endY) dirY = 1;
+
+    if (dirX == 0 && dirY == 0) {
+      p++;
+      continue;
+    }
+
+    outgoing[neighborSlot(dirX, dirY)].push_back(particles, p);
+    particles.copy(p, --numRemaining);
+  }
+  particles.resize(numRemaining);
+}
+
+void wrapIncoming(double *x, double *y, int first, int end, int cellX, int cellY, int numCellsPerDim, double boxMin, double boxMax) {
+  for(int i=first; i<end; i++) {
+
+    if(cellY == 0) { // Top boundary cell
+
+      if(y[i] > boxMax) // reset position
+        y[i] = y[i] - boxMax;
+
+    } else if(cellY == numCellsPerDim - 1) { // Bottom boundary cell
+
+      if(y[i] < boxMin) //reset position
+        y[i] = boxMax + y[i];
+
+    }
+
+    if(cellX == 0) { // Left boundary cell
+
+      if(x[i] > boxMax) // reset position
+        x[i] = x[i] - boxMax;
+
+    } else if(cellX == numCellsPerDim - 1) { // Right boundary cell
+
+      if(x[i] < boxMin) // reset position
+        x[i] = boxMax + x[i];
+
+    }
+  }
+}
+
+// A cell includes its upper edge, which floor() places in the next cell, so a particle
+// starting there is one cell further than its displacement alone would take it
+int exchangeWindowRadius(int stepsPerExchange, int velocityFactor, double cellDim) {
+  return (int) ceil(stepsPerExchange/(velocityFactor*cellDim)) + 1;
+}
+
+void bucketByOwner(const ParticleArray &particles, int ppcEqualDist, int numCells, std::vector<int> &owners, std::vector<ParticleArray> &buckets) {
+  int n = particles.size();
+  const int *gid = particles.gid.data();
+  owners.clear();
+  if(n == 0) {
+    buckets.clear();
+    return;
+  }
+
+  // The owner grows with the gid, so the owners of my particles lie between those of
+  // my smallest and largest gid: a small contiguous range of cells after a run
+  int minGid = gid[0], maxGid = gid[0];
+  for(int i=1; i<n; i++) {
+    minGid = std::min(minGid, gid[i]);
+    maxGid = std::max(maxGid, gid[i]);
+  }
+  int minOwner = ownerOfGid(minGid, ppcEqualDist, numCells);
+  int numOwners = ownerOfGid(maxGid, ppcEqualDist, numCells) - minOwner + 1;
+
+  // Counting pass into a dense table over that range
+  std::vector<int> counts(numOwners, 0);
+  for(int i=0; i<n; i++)
+    counts[ownerOfGid(gid[i], ppcEqualDist, numCells) - minOwner]++;
+
+  // Prefix sum over the owners that got particles: bucket of each owner, in owner order
+  std::vector<int> bucketOf(numOwners, -1);
+  for(int o=0; o<numOwners; o++) {
+    if(counts[o] > 0) {
+      bucketOf[o] = owners.size();
+      owners.push_back(minOwner + o);
+    }
+  }
+
+  buckets.resize(owners.size());
+  for(int b=0; b<owners.size(); b++)
+    buckets[b].resize(counts[owners[b] - minOwner]);
+
+  // Scatter every particle to the next free entry of its bucket
+  std::vector<int> next(owners.size(), 0);
+  for(int i=0; i<n; i++) {
+    int b = bucketOf[ownerOfGid(gid[i], ppcEqualDist, numCells) - minOwner];
+    ParticleArray &bucket = buckets[b];
+    int k = next[b]++;
+    bucket.gid[k] = gid[i];
+    bucket.x[k] = particles.x[i];
+    bucket.y[k] = particles.y[i];
+    bucket.color[k] = particles.color[i];
+  }
+}
@@ -0,0 +1,48 @@
+#ifndef PARTICLE_KERNELS_H
+#define PARTICLE_KERNELS_H
+
+#include <math.h>
+#include <vector>
+#include "particle_array.h"
+
+/*
+*The per-particle loops of a time step and of the post-simulation reorganization, kept free of the Charm++ runtime so that
+*bench/kernel_bench.cpp can time them on their own. Cell calls the same functions.
+*/
+
+// index into an 8-entry neighbor table of direction (dirX, dirY), each in {-1, 0, 1}
+inline int neighborSlot(int dirX, int dirY) {
+  int index = (dirX + 1) * 3 + (dirY + 1);
+  return index > 4 ? index - 1 : index; // skip (0, 0), which is the cell itself
+}
+
+// Move the particles outside [startX, endX] x [startY, endY] into the outgoing
+// buffer of their neighbor (outgoing has 8 entries, indexed by neighborSlot)
+void partitionParticles(ParticleArray &particles, double startX, double endX, double startY, double endY, ParticleArray *outgoing);
+
+// Wrap the incoming particles [first, end) of cell (cellX, cellY) that crossed the box boundary
+void wrapIncoming(double *x, double *y, int first, int end, int cellX, int cellY, int numCellsPerDim, double boxMin, double boxMax);
+
+// Cell of the grid holding coordinate x in one dimension, clamped to the box
+inline int cellOfCoordinate(double x, double cellDim, int numCellsPerDim) {
+  int c = (int) floor(x/cellDim);
+  return c < 0 ? 0 : c < numCellsPerDim ? c : numCellsPerDim - 1;
+}
+
+// Cells a particle can get from the one it started in, in each dimension, over
+// stepsPerExchange steps of at most 1/velocityFactor each
+int exchangeWindowRadius(int stepsPerExchange, int velocityFactor, double cellDim);
+
+// Cell owning a gid after the reorganization: ppcEqualDist gids per cell, the remainder
+// going to the last of numCells cells
+inline int ownerOfGid(int gid, int ppcEqualDist, int numCells) {
+  int owner = (gid - 1) / ppcEqualDist;
+  return owner < numCells ? owner : numCells - 1;
+}
+
+// Group the particles by owner cell with a counting pass over the range of their owners
+// instead of a sort: owners gets the distinct owners in increasing order and buckets[b]
+// the particles owned by owners[b], in their original order
+void bucketByOwner(const ParticleArray &particles, int ppcEqualDist, int numCells, std::vector<int> &owners, std::vector<ParticleArray> &buckets);
+
+#endif
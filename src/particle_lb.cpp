@@ -0,0 +1,172 @@
+#include "particle_lb.h"
+#include "particleSimulation.decl.h"
+#include <algorithm>
+#include <map>
+#include <math.h>
+
+extern CProxy_Cell cellProxy;
+extern CProxy_SubCell subCellProxy;
+extern int numCellsPerDim;
+
+CreateLBFunc_Def(ParticleLB, "Recursive bisection of the cell grid weighted by particle count")
+
+ParticleLB::ParticleLB(const CkLBOptions &opt) : CBase_ParticleLB(opt) {
+  lbname = "ParticleLB";
+  if(CkMyPe() == 0)
+    CkPrintf("[%d] ParticleLB created\n", CkMyPe());
+}
+
+// Split [x0, x1) x [y0, y1) into numRegions rectangles of about equal load, appended to
+// regions in order. The longer side is cut where the load on each side best matches
+// the share of regions it gets.
+void ParticleLB::bisect(const std::vector<double> &load, int x0, int x1, int y0, int y1, int numRegions, std::vector<Region> &regions) {
+  bool cutX = x1 - x0 >= y1 - y0;
+  int length = cutX ? x1 - x0 : y1 - y0;
+
+  // One region, or a single cell line that cannot be cut: the PEs left over stay empty
+  if(numRegions == 1 || length == 1) {
+    Region r = { x0, x1, y0, y1 };
+    regions.push_back(r);
+    for(int i=1; i<numRegions; i++) {
+      Region empty = { x0, x0, y0, y0 };
+      regions.push_back(empty);
+    }
+    return;
+  }
+
+  // load of each line across the cut direction
+  std::vector<double> lineLoad(length, 0.0);
+  double total = 0;
+  for(int x=x0; x<x1; x++) {
+    for(int y=y0; y<y1; y++) {
+      double l = load[x*numCellsPerDim + y];
+      lineLoad[cutX ? x - x0 : y - y0] += l;
+      total += l;
+    }
+  }
+
+  int leftRegions = numRegions/2;
+  double target = total * leftRegions / numRegions;
+
+  // Choose the cut, keeping at least one line on each side
+  int cut = 1;
+  double prefix = 0, bestError = -1;
+  for(int k=1; k<length; k++) {
+    prefix += lineLoad[k - 1];
+    double error = fabs(prefix - target);
+    if(bestError < 0 || error < bestError) {
+      bestError = error;
+      cut = k;
+    }
+  }
+
+  if(cutX) {
+    bisect(load, x0, x0 + cut, y0, y1, leftRegions, regions);
+    bisect(load, x0 + cut, x1, y0, y1, numRegions - leftRegions, regions);
+  } else {
+    bisect(load, x0, x1, y0, y0 + cut, leftRegions, regions);
+    bisect(load, x0, x1, y0 + cut, y1, numRegions - leftRegions, regions);
+  }
+}
+
+void ParticleLB::work(LDStats *stats) {
+  int numObjs = stats->n_objs;
+  int numCells = numCellsPerDim * numCellsPerDim;
+
+  std::vector<int> pes;
+  for(int pe=0; pe<stats->nprocs(); pe++)
+    if(stats->procs[pe].available)
+      pes.push_back(pe);
+  if(pes.empty())
+    CkAbort("ParticleLB: no available processor");
+
+  // Place every cell on the grid, and remember the parent of every SubCell; other
+  // objects stay where they are
+  std::vector<double> load(numCells, 0.0);
+  std::vector<int> objOfCell(numCells, -1);
+  std::vector<std::pair<int, int> > children; // (object, parent cell)
+  CkLocMgr *locMgr = cellProxy.ckLocMgr();
+  CkLocMgr *childLocMgr = subCellProxy.ckLocMgr();
+
+  for(int obj=0; obj<numObjs; obj++) {
+    stats->to_proc[obj] = stats->from_proc[obj];
+
+    CkArrayIndex index;
+    if(!stats->objData[obj].migratable)
+      continue;
+    if(childLocMgr->lookupID(stats->objData[obj].objID(), index) && index.dimension == 3) {
+      children.push_back(std::make_pair(obj, index.data()[0]*numCellsPerDim + index.data()[1]));
+      continue;
+    }
+    if(!locMgr->lookupID(stats->objData[obj].objID(), index) || index.dimension != 2)
+      continue;
+
+    int x = index.data()[0], y = index.data()[1];
+    if(x < 0 || x >= numCellsPerDim || y < 0 || y >= numCellsPerDim)
+      continue;
+
+    load[x*numCellsPerDim + y] = stats->objData[obj].wallTime;
+    objOfCell[x*numCellsPerDim + y] = obj;
+  }
+
+  std::vector<Region> regions;
+  bisect(load, 0, numCellsPerDim, 0, numCellsPerDim, pes.size(), regions);
+
+  // Number of cells of each region already on each PE
+  std::vector<std::map<int, int> > resident(regions.size());
+  for(int r=0; r<regions.size(); r++)
+    for(int x=regions[r].x0; x<regions[r].x1; x++)
+      for(int y=regions[r].y0; y<regions[r].y1; y++)
+        if(objOfCell[x*numCellsPerDim + y] >= 0)
+          resident[r][stats->from_proc[objOfCell[x*numCellsPerDim + y]]]++;
+
+  // Greedily give each region the PE that holds most of its cells
+  std::vector<std::pair<int, std::pair<int, int> > > overlaps; // (cells, (region, pe))
+  for(int r=0; r<regions.size(); r++)
+    for(std::map<int, int>::iterator it = resident[r].begin(); it != resident[r].end(); ++it)
+      overlaps.push_back(std::make_pair(it->second, std::make_pair(r, it->first)));
+  std::sort(overlaps.rbegin(), overlaps.rend());
+
+  std::vector<int> peOfRegion(regions.size(), -1);
+  std::vector<bool> peTaken(stats->nprocs(), false);
+  for(int i=0; i<overlaps.size(); i++) {
+    int r = overlaps[i].second.first, pe = overlaps[i].second.second;
+    if(peOfRegion[r] < 0 && !peTaken[pe] && stats->procs[pe].available) {
+      peOfRegion[r] = pe;
+      peTaken[pe] = true;
+    }
+  }
+
+  int nextPe = 0;
+  for(int r=0; r<regions.size(); r++) {
+    if(peOfRegion[r] >= 0) continue;
+    while(peTaken[pes[nextPe]]) nextPe++;
+    peOfRegion[r] = pes[nextPe];
+    peTaken[pes[nextPe]] = true;
+  }
+
+  int numMigrations = 0;
+  for(int r=0; r<regions.size(); r++) {
+    for(int x=regions[r].x0; x<regions[r].x1; x++) {
+      for(int y=regions[r].y0; y<regions[r].y1; y++) {
+        int obj = objOfCell[x*numCellsPerDim + y];
+        if(obj < 0) continue;
+        stats->to_proc[obj] = peOfRegion[r];
+        if(peOfRegion[r] != stats->from_proc[obj])
+          numMigrations++;
+      }
+    }
+  }
+
+  // Children follow their parent, which relays every particle they exchange
+  for(int i=0; i<children.size(); i++) {
+    int parent = objOfCell[children[i].second];
+    if(parent >= 0)
+      stats->to_proc[children[i].first] = stats->to_proc[parent];
+  }
+
+  if(_lb_args.debug())
+    CkPrintf("ParticleLB: %d regions, %d of %d cells migrate\n", (int) regions.size(), numMigrations, numCells);
+}
+
+#include "ParticleLB.def.h"
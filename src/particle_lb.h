@@ -0,0 +1,37 @@
+#ifndef PARTICLE_LB_H
+#define PARTICLE_LB_H
+
+#include <vector>
+#include "CentralLB.h"
+#include "ParticleLB.decl.h"
+
+void CreateParticleLB();
+
+/*
+*Central load balancer for the 2D grid of cells (run with +balancer ParticleLB).
+*The grid is split into one rectangle of contiguous cells per PE by recursive
+*bisection of the object loads, cutting the longer side of each rectangle so that
+*the regions stay compact and most neighbor exchanges stay on the same PE. The
+*rectangles are then matched to the PEs that already hold most of their cells, so
+*few cells migrate. With --particle-load the load of a cell is its particle count.
+*The SubCell children of a refined cell go to the PE of their parent.
+*/
+
+class ParticleLB : public CBase_ParticleLB {
+  public:
+    ParticleLB(const CkLBOptions &opt);
+    ParticleLB(CkMigrateMessage *m) : CBase_ParticleLB(m) { lbname = "ParticleLB"; }
+
+    void work(LDStats *stats);
+
+  private:
+    struct Region {
+      int x0, x1, y0, y1; // cells [x0, x1) x [y0, y1)
+    };
+
+    bool QueryBalanceNow(int step) { return true; }
+
+    void bisect(const std::vector<double> &load, int x0, int x1, int y0, int y1, int numRegions, std::vector<Region> &regions);
+};
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef PARTICLE_MSG_H
+#define PARTICLE_MSG_H
+
+#include <string.h>
+#include <vector>
+#include "particle_array.h"
+#include "particle_codec.h"
+
+/*
+*Varsize message carrying a batch of particles between neighboring cells.
+*The particle attributes travel as four contiguous arrays, so a batch is
+*copied once into the message on the sender and read in place by the receiver.
+*Alternatively the batch travels in the compact ParticleCodec encoding in packed,
+*and the four arrays are empty.
+*The reference number of the message is the iteration it belongs to.
+*/
+
+class ParticleMsg : public CMessage_ParticleMsg {
+public:
+    int iter;          // iteration the batch belongs to
+    int senderX;       // x index of the sending cell
+    int senderY;       // y index of the sending cell
+    int numParticles;
+    int numPackedBytes; // 0 unless the batch is encoded in packed
+    int numBatches;     // 0 for a partial batch of a streamed exchange, else the number of
+                        // batches the sender sends to this cell in the iteration, this one included
+    bool viaInbox;      // the batch itself was handed over through the node's ParticleInbox
+
+    int *gid;
+    double *x;
+    double *y;
+    char *color;
+    char *packed;
+
+    static ParticleMsg *build(const ParticleArray &batch, int iter, int senderX, int senderY) {
+      int n = batch.size();
+      ParticleMsg *msg = new (n, n, n, n, 0) ParticleMsg;
+      msg->iter = iter;
+      msg->senderX = senderX;
+      msg->senderY = senderY;
+      msg->numParticles = n;
+      msg->numPackedBytes = 0;
+      msg->numBatches = 1;
+      msg->viaInbox = false;
+      memcpy(msg->gid, batch.gid.data(), n*sizeof(int));
+      memcpy(msg->x, batch.x.data(), n*sizeof(double));
+      memcpy(msg->y, batch.y.data(), n*sizeof(double));
+      memcpy(msg->color, batch.color.data(), n*sizeof(char));
+      CkSetRefNum(msg, iter);
+      return msg;
+    }
+
+    // Build a message around a batch already encoded by ParticleCodec
+    static ParticleMsg *buildPacked(const char *bytes, int numBytes, int iter, int senderX, int senderY) {
+      ParticleMsg *msg = new (0, 0, 0, 0, numBytes) ParticleMsg;
+      msg->iter = iter;
+      msg->senderX = senderX;
+      msg->senderY = senderY;
+      msg->numParticles = ParticleCodec::decodedCount(bytes);
+      msg->numPackedBytes = numBytes;
+      msg->numBatches = 1;
+      msg->viaInbox = false;
+      memcpy(msg->packed, bytes, numBytes);
+      CkSetRefNum(msg, iter);
+      return msg;
+    }
+
+    // Build the notice for a batch handed over through the node's ParticleInbox
+    static ParticleMsg *buildNotice(int iter, int senderX, int senderY) {
+      ParticleMsg *msg = new (0, 0, 0, 0, 0) ParticleMsg;
+      msg->iter = iter;
+      msg->senderX = senderX;
+      msg->senderY = senderY;
+      msg->numParticles = 0;
+      msg->numPackedBytes = 0;
+      msg->numBatches = 1;
+      msg->viaInbox = true;
+      CkSetRefNum(msg, iter);
+      return msg;
+    }
+
+    // Append the particles of the message to out, decoding them if needed
+    void appendTo(ParticleArray &out) const {
+      if(numPackedBytes > 0)
+        ParticleCodec::decode(packed, out);
+      else
+        out.append(gid, x, y, color, numParticles);
+    }
+};
+
+#endif
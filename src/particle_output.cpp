@@ -0,0 +1,60 @@
+#include "charm++.h"
+#include "particle_output.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+// pwrite the whole buffer, resuming after partial writes and interrupts
+static void pwriteAll(int fd, const char *buffer, size_t numBytes, off_t offset, const std::string &path) {
+  while(numBytes > 0) {
+    ssize_t written = pwrite(fd, buffer, numBytes, offset);
+    if(written < 0) {
+      if(errno == EINTR) continue;
+      CmiAbort("Error while writing %s: %s", path.c_str(), strerror(errno));
+    }
+    buffer += written;
+    offset += written;
+    numBytes -= written;
+  }
+}
+
+void createParticleFile(const std::string &path, int numCellsPerDim, int64_t numParticles) {
+  int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0)
+    CmiAbort("Error while creating %s: %s", path.c_str(), strerror(errno));
+
+  ParticleFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, "PARTBIN", 8);
+  header.version = PARTICLE_FILE_VERSION;
+  header.recordSize = sizeof(ParticleRecord);
+  header.numCellsPerDim = numCellsPerDim;
+  header.numParticles = numParticles;
+  pwriteAll(fd, (const char *) &header, sizeof(header), 0, path);
+
+  // Size the file up front so that cells finishing early do not extend it concurrently
+  if(ftruncate(fd, sizeof(header) + numParticles * sizeof(ParticleRecord)) != 0)
+    CmiAbort("Error while sizing %s: %s", path.c_str(), strerror(errno));
+  close(fd);
+}
+
+void writeParticleRecords(const std::string &path, int64_t firstRecord, const std::vector<Particle> &particles) {
+  std::vector<ParticleRecord> records(particles.size());
+  for(size_t i=0; i<particles.size(); i++) {
+    ParticleRecord &r = records[i];
+    r.x = particles[i].x;
+    r.y = particles[i].y;
+    r.gid = particles[i].gid;
+    r.color = particles[i].color;
+    r.pad[0] = r.pad[1] = r.pad[2] = 0;
+  }
+
+  int fd = open(path.c_str(), O_WRONLY);
+  if(fd < 0)
+    CmiAbort("Error while opening %s: %s", path.c_str(), strerror(errno));
+
+  off_t offset = sizeof(ParticleFileHeader) + firstRecord * sizeof(ParticleRecord);
+  pwriteAll(fd, (const char *) records.data(), records.size() * sizeof(ParticleRecord), offset, path);
+  close(fd);
+}
@@ -0,0 +1,51 @@
+#ifndef PARTICLE_OUTPUT_H
+#define PARTICLE_OUTPUT_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "pup_stl.h"
+#include "particle.h"
+
+/*
+*Binary particle output (--output-format binary).
+*All cells write into one shared file: a ParticleFileHeader followed by one
+*ParticleRecord per particle, ordered by gid. After the reorganization a cell
+*holds the contiguous gid range starting at linearCellId*ppcEqualDist + 1, so it
+*knows the offset of its records and writes them with a single pwrite, without
+*any coordination beyond Main creating the file first.
+*
+*Fields are in the native byte order. scripts/particles_to_text.py converts the
+*file to the per-cell text files of the text format. The scripts read the layout
+*from scripts/particle_format.py, which must change along with these structs.
+*/
+
+#define PARTICLE_FILE_NAME "particles.bin"
+#define PARTICLE_FILE_VERSION 1
+
+struct ParticleFileHeader {
+  char magic[8];        // "PARTBIN\0"
+  int32_t version;
+  int32_t recordSize;
+  int32_t numCellsPerDim;
+  int32_t reserved;
+  int64_t numParticles;
+};
+
+struct ParticleRecord {
+  double x, y;
+  int32_t gid;
+  char color;
+  char pad[3];
+};
+
+static_assert(sizeof(ParticleFileHeader) == 32, "ParticleFileHeader must match the converter");
+static_assert(sizeof(ParticleRecord) == 24, "ParticleRecord must match the converter");
+
+// Create (or truncate) the file, write the header and size it for numParticles records
+void createParticleFile(const std::string &path, int numCellsPerDim, int64_t numParticles);
+
+// Write particles, sorted by gid, as the records starting at index firstRecord
+void writeParticleRecords(const std::string &path, int64_t firstRecord, const std::vector<Particle> &particles);
+
+#endif
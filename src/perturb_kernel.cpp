@@ -0,0 +1,212 @@
+#include "perturb_kernel.h"
+#include <math.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#endif
+
+// Compact color codes used to look up the velocity divisor without branching
+enum { COLOR_RED = 0, COLOR_BLUE = 1, COLOR_GREEN = 2, COLOR_NONE = 3 };
+
+static inline int colorCode(char c) {
+  return c == 'r' ? COLOR_RED : c == 'b' ? COLOR_BLUE : c == 'g' ? COLOR_GREEN : COLOR_NONE;
+}
+
+// Cody-Waite split of pi/2: pio2_1 has 33 significant bits, so k*pio2_1 is exact for |k| < 2^20
+static const double twoOverPi = 6.36619772367581382433e-01;
+static const double pio2_1 = 1.57079632673412561417e+00;
+static const double pio2_2 = 6.07710050630396597660e-11;
+static const double pio2_3 = 2.02226624871116645580e-21;
+
+// 1.5 * 2^52: adding it rounds to an integer that sits in the low mantissa bits
+static const double roundMagic = 6755399441055744.0;
+
+// fdlibm minimax coefficients for sin and cos on [-pi/4, pi/4]
+static const double S1 = -1.66666666666666324348e-01;
+static const double S2 =  8.33333333332248946124e-03;
+static const double S3 = -1.98412698298579493134e-04;
+static const double S4 =  2.75573137070700676789e-06;
+static const double S5 = -2.50507602534068634195e-08;
+static const double S6 =  1.58969099521155010221e-10;
+
+static const double C1 =  4.16666666666666019037e-02;
+static const double C2 = -1.38888888888741095749e-03;
+static const double C3 =  2.48015872894767294178e-05;
+static const double C4 = -2.75573143513906633035e-07;
+static const double C5 =  2.08757232129817482790e-09;
+static const double C6 = -1.13596475577881948265e-11;
+
+double fastCos(double x) {
+  double t = x * twoOverPi + roundMagic;
+  double k = t - roundMagic;
+  uint64_t bits;
+  memcpy(&bits, &t, sizeof(bits));
+
+  double r = x - k * pio2_1;
+  r = r - k * pio2_2;
+  r = r - k * pio2_3;
+
+  double z = r * r;
+  double s = r + r * z * (S1 + z * (S2 + z * (S3 + z * (S4 + z * (S5 + z * S6)))));
+  double c = 1.0 - 0.5 * z + z * z * (C1 + z * (C2 + z * (C3 + z * (C4 + z * (C5 + z * C6)))));
+
+  // cos(x) for quadrant q = k mod 4 is cos(r), -sin(r), -cos(r), sin(r)
+  double v = (bits & 1) ? s : c;
+  return ((bits + 1) & 2) ? -v : v;
+}
+
+static void perturbExact(double *x, double *y, const char *color, int n, int velocityFactor) {
+  const double divisor[4] = { (double) velocityFactor, (double) (velocityFactor * 2), (double) (velocityFactor * 5), HUGE_VAL };
+
+  for(int i=0; i<n; i++) {
+    double deltax = cos(y[i]);
+    double deltay = cos(x[i]);
+    double d = divisor[colorCode(color[i])];
+    x[i] += deltax/d;
+    y[i] += deltay/d;
+  }
+}
+
+static void perturbFastScalar(double *x, double *y, const char *color, int begin, int n, const double *scale) {
+  for(int i=begin; i<n; i++) {
+    double deltax = fastCos(y[i]);
+    double deltay = fastCos(x[i]);
+    double s = scale[colorCode(color[i])];
+    x[i] += deltax * s;
+    y[i] += deltay * s;
+  }
+}
+
+#if defined(__AVX512F__)
+
+static inline __m512d fastCos8(__m512d x) {
+  __m512d t = _mm512_fmadd_pd(x, _mm512_set1_pd(twoOverPi), _mm512_set1_pd(roundMagic));
+  __m512d k = _mm512_sub_pd(t, _mm512_set1_pd(roundMagic));
+  __m512i bits = _mm512_castpd_si512(t);
+
+  __m512d r = _mm512_fnmadd_pd(k, _mm512_set1_pd(pio2_1), x);
+  r = _mm512_fnmadd_pd(k, _mm512_set1_pd(pio2_2), r);
+  r = _mm512_fnmadd_pd(k, _mm512_set1_pd(pio2_3), r);
+  __m512d z = _mm512_mul_pd(r, r);
+
+  __m512d ps = _mm512_fmadd_pd(z, _mm512_set1_pd(S6), _mm512_set1_pd(S5));
+  ps = _mm512_fmadd_pd(z, ps, _mm512_set1_pd(S4));
+  ps = _mm512_fmadd_pd(z, ps, _mm512_set1_pd(S3));
+  ps = _mm512_fmadd_pd(z, ps, _mm512_set1_pd(S2));
+  ps = _mm512_fmadd_pd(z, ps, _mm512_set1_pd(S1));
+  __m512d s = _mm512_fmadd_pd(_mm512_mul_pd(r, z), ps, r);
+
+  __m512d pc = _mm512_fmadd_pd(z, _mm512_set1_pd(C6), _mm512_set1_pd(C5));
+  pc = _mm512_fmadd_pd(z, pc, _mm512_set1_pd(C4));
+  pc = _mm512_fmadd_pd(z, pc, _mm512_set1_pd(C3));
+  pc = _mm512_fmadd_pd(z, pc, _mm512_set1_pd(C2));
+  pc = _mm512_fmadd_pd(z, pc, _mm512_set1_pd(C1));
+  __m512d c = _mm512_fmadd_pd(_mm512_mul_pd(z, z), pc, _mm512_fnmadd_pd(_mm512_set1_pd(0.5), z, _mm512_set1_pd(1.0)));
+
+  __mmask8 useSin = _mm512_test_epi64_mask(bits, _mm512_set1_epi64(1));
+  __m512d v = _mm512_mask_blend_pd(useSin, c, s);
+  __m512i sign = _mm512_slli_epi64(_mm512_and_si512(_mm512_add_epi64(bits, _mm512_set1_epi64(1)), _mm512_set1_epi64(2)), 62);
+  return _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(v), sign));
+}
+
+static inline __m512d colorScale8(const char *color, const double *scale) {
+  __m512i c = _mm512_cvtepu8_epi64(_mm_loadl_epi64((const __m128i *) color));
+  __m512d s = _mm512_setzero_pd();
+  s = _mm512_mask_blend_pd(_mm512_cmpeq_epi64_mask(c, _mm512_set1_epi64('r')), s, _mm512_set1_pd(scale[COLOR_RED]));
+  s = _mm512_mask_blend_pd(_mm512_cmpeq_epi64_mask(c, _mm512_set1_epi64('b')), s, _mm512_set1_pd(scale[COLOR_BLUE]));
+  s = _mm512_mask_blend_pd(_mm512_cmpeq_epi64_mask(c, _mm512_set1_epi64('g')), s, _mm512_set1_pd(scale[COLOR_GREEN]));
+  return s;
+}
+
+static void perturbFast(double *x, double *y, const char *color, int n, const double *scale) {
+  int i = 0;
+  for(; i+8<=n; i+=8) {
+    __m512d vx = _mm512_loadu_pd(x + i);
+    __m512d vy = _mm512_loadu_pd(y + i);
+    __m512d s = colorScale8(color + i, scale);
+    __m512d deltax = fastCos8(vy);
+    __m512d deltay = fastCos8(vx);
+    _mm512_storeu_pd(x + i, _mm512_fmadd_pd(deltax, s, vx));
+    _mm512_storeu_pd(y + i, _mm512_fmadd_pd(deltay, s, vy));
+  }
+  perturbFastScalar(x, y, color, i, n, scale);
+}
+
+#elif defined(__AVX2__) && defined(__FMA__)
+
+static inline __m256d fastCos4(__m256d x) {
+  __m256d t = _mm256_fmadd_pd(x, _mm256_set1_pd(twoOverPi), _mm256_set1_pd(roundMagic));
+  __m256d k = _mm256_sub_pd(t, _mm256_set1_pd(roundMagic));
+  __m256i bits = _mm256_castpd_si256(t);
+
+  __m256d r = _mm256_fnmadd_pd(k, _mm256_set1_pd(pio2_1), x);
+  r = _mm256_fnmadd_pd(k, _mm256_set1_pd(pio2_2), r);
+  r = _mm256_fnmadd_pd(k, _mm256_set1_pd(pio2_3), r);
+  __m256d z = _mm256_mul_pd(r, r);
+
+  __m256d ps = _mm256_fmadd_pd(z, _mm256_set1_pd(S6), _mm256_set1_pd(S5));
+  ps = _mm256_fmadd_pd(z, ps, _mm256_set1_pd(S4));
+  ps = _mm256_fmadd_pd(z, ps, _mm256_set1_pd(S3));
+  ps = _mm256_fmadd_pd(z, ps, _mm256_set1_pd(S2));
+  ps = _mm256_fmadd_pd(z, ps, _mm256_set1_pd(S1));
+  __m256d s = _mm256_fmadd_pd(_mm256_mul_pd(r, z), ps, r);
+
+  __m256d pc = _mm256_fmadd_pd(z, _mm256_set1_pd(C6), _mm256_set1_pd(C5));
+  pc = _mm256_fmadd_pd(z, pc, _mm256_set1_pd(C4));
+  pc = _mm256_fmadd_pd(z, pc, _mm256_set1_pd(C3));
+  pc = _mm256_fmadd_pd(z, pc, _mm256_set1_pd(C2));
+  pc = _mm256_fmadd_pd(z, pc, _mm256_set1_pd(C1));
+  __m256d c = _mm256_fmadd_pd(_mm256_mul_pd(z, z), pc, _mm256_fnmadd_pd(_mm256_set1_pd(0.5), z, _mm256_set1_pd(1.0)));
+
+  __m256i one = _mm256_set1_epi64x(1);
+  __m256d useSin = _mm256_castsi256_pd(_mm256_cmpeq_epi64(_mm256_and_si256(bits, one), one));
+  __m256d v = _mm256_blendv_pd(c, s, useSin);
+  __m256i sign = _mm256_slli_epi64(_mm256_and_si256(_mm256_add_epi64(bits, one), _mm256_set1_epi64x(2)), 62);
+  return _mm256_xor_pd(v, _mm256_castsi256_pd(sign));
+}
+
+static inline __m256d colorScale4(const char *color, const double *scale) {
+  int packed;
+  memcpy(&packed, color, sizeof(packed));
+  __m256i c = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(packed));
+  __m256d red = _mm256_castsi256_pd(_mm256_cmpeq_epi64(c, _mm256_set1_epi64x('r')));
+  __m256d blue = _mm256_castsi256_pd(_mm256_cmpeq_epi64(c, _mm256_set1_epi64x('b')));
+  __m256d green = _mm256_castsi256_pd(_mm256_cmpeq_epi64(c, _mm256_set1_epi64x('g')));
+  __m256d s = _mm256_and_pd(red, _mm256_set1_pd(scale[COLOR_RED]));
+  s = _mm256_or_pd(s, _mm256_and_pd(blue, _mm256_set1_pd(scale[COLOR_BLUE])));
+  s = _mm256_or_pd(s, _mm256_and_pd(green, _mm256_set1_pd(scale[COLOR_GREEN])));
+  return s;
+}
+
+static void perturbFast(double *x, double *y, const char *color, int n, const double *scale) {
+  int i = 0;
+  for(; i+4<=n; i+=4) {
+    __m256d vx = _mm256_loadu_pd(x + i);
+    __m256d vy = _mm256_loadu_pd(y + i);
+    __m256d s = colorScale4(color + i, scale);
+    __m256d deltax = fastCos4(vy);
+    __m256d deltay = fastCos4(vx);
+    _mm256_storeu_pd(x + i, _mm256_fmadd_pd(deltax, s, vx));
+    _mm256_storeu_pd(y + i, _mm256_fmadd_pd(deltay, s, vy));
+  }
+  perturbFastScalar(x, y, color, i, n, scale);
+}
+
+#else
+
+static void perturbFast(double *x, double *y, const char *color, int n, const double *scale) {
+  perturbFastScalar(x, y, color, 0, n, scale);
+}
+
+#endif
+
+void perturbParticles(double *x, double *y, const char *color, int n, int velocityFactor, int mode) {
+  if(mode == PERTURB_FAST) {
+    const double scale[4] = { 1.0/velocityFactor, 1.0/(velocityFactor * 2), 1.0/(velocityFactor * 5), 0.0 };
+    perturbFast(x, y, color, n, scale);
+  } else {
+    perturbExact(x, y, color, n, velocityFactor);
+  }
+}
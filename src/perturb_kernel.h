@@ -0,0 +1,23 @@
+#ifndef PERTURB_KERNEL_H
+#define PERTURB_KERNEL_H
+
+/*
+*Batched perturbation of whole particle arrays.
+*
+*Each particle moves by (cos(y), cos(x)) divided by a per-color velocity divisor:
+*velocityFactor for red, 2*velocityFactor for blue and 5*velocityFactor for green.
+*Particles of any other color do not move.
+*/
+
+enum PerturbMode {
+  PERTURB_EXACT = 0, // libm cos and true division: bit-identical to the reference output
+  PERTURB_FAST  = 1  // vectorized polynomial cos and reciprocal multiply (a few ulp off)
+};
+
+// Perturb n particles in place using the kernel selected by mode
+void perturbParticles(double *x, double *y, const char *color, int n, int velocityFactor, int mode);
+
+// Reduced-accuracy cosine used by PERTURB_FAST (scalar version of the vector kernel)
+double fastCos(double x);
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef PHASE_TIMERS_H
+#define PHASE_TIMERS_H
+
+#include "particleSimulation.decl.h"
+
+/*
+*Wall-clock time a cell spends in each phase of an iteration of Cell::run().
+*Every cell accumulates its phases between two reductions and contributes them
+*along with its particle counts. The reduction keeps min, sum and max per phase
+*and the cell that holds the max, so Main can print min/avg/max per step.
+*
+*A phase nested in another one (perturb within pack, unpack within wait) is
+*charged to the inner phase and taken out of the enclosing one, so the phases
+*of a cell never overlap.
+*/
+
+enum {
+  PHASE_PERTURB,  // moving the particles
+  PHASE_PACK,     // classifying the particles and sending the leavers
+  PHASE_WAIT,     // waiting for the neighbors' batches
+  PHASE_UNPACK,   // applying the received batches
+  PHASE_LB,       // from AtSync to ResumeFromSync, on each PE the cell lived on
+  PHASE_SNAPSHOT, // staging a trajectory snapshot
+  NUM_PHASES
+};
+
+inline const char *phaseName(int phase) {
+  static const char *names[NUM_PHASES] = { "perturb", "pack", "wait", "unpack", "lb", "snapshot" };
+  return names[phase];
+}
+
+// Seconds spent in one phase, reduced over the cells
+struct PhaseStat {
+  double min, sum, max;
+  int maxCell;   // linear index of the cell holding the max
+  int numCells;
+};
+PUPbytes(PhaseStat)
+
+// Reduce the stats of one contribution into another, phase by phase
+inline void combinePhaseStats(PhaseStat *into, const PhaseStat *from) {
+  for(int p=0; p<NUM_PHASES; p++) {
+    if(from[p].min < into[p].min)
+      into[p].min = from[p].min;
+    // Ties go to the lower cell index, so the reported cell does not depend on the message order
+    if(from[p].max > into[p].max || (from[p].max == into[p].max && from[p].maxCell < into[p].maxCell)) {
+      into[p].max = from[p].max;
+      into[p].maxCell = from[p].maxCell;
+    }
+    into[p].sum += from[p].sum;
+    into[p].numCells += from[p].numCells;
+  }
+}
+
+class PhaseTimers {
+  double elapsed[NUM_PHASES];
+  double started;
+
+  public:
+    PhaseTimers() { reset(); }
+
+    void reset() {
+      for(int p=0; p<NUM_PHASES; p++)
+        elapsed[p] = 0.0;
+      started = 0.0;
+    }
+
+    void start() { started = CkWallTimer(); }
+
+    // Charge the time since start() to phase
+    void stop(int phase) { elapsed[phase] += CkWallTimer() - started; }
+
+    // Charge seconds measured inside enclosing to phase instead
+    void charge(int phase, int enclosing, double seconds) {
+      elapsed[phase] += seconds;
+      elapsed[enclosing] -= seconds;
+    }
+
+    // Stats of this cell alone, ready to be contributed
+    void fill(PhaseStat *stats, int cell) const {
+      for(int p=0; p<NUM_PHASES; p++) {
+        stats[p].min = stats[p].sum = stats[p].max = elapsed[p];
+        stats[p].maxCell = cell;
+        stats[p].numCells = 1;
+      }
+    }
+
+    // Wall clocks of different processes do not compare, so a cell migrating in a phase
+    // stops it before leaving and starts it again on arrival instead of moving started
+    void pup(PUP::er &p) {
+      PUParray(p, elapsed, NUM_PHASES);
+    }
+};
+
+#endif
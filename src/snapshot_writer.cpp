@@ -0,0 +1,208 @@
+#include "snapshot_writer.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+extern CProxy_Main mainProxy;
+extern int snapshotFreq;
+
+// Snapshot files kept open by the thread; cells lagging behind may still add to older ones
+#define MAX_OPEN_SNAPSHOTS 4
+
+// How often finish() looks again whether the thread is done
+#define FINISH_POLL_MS 10
+
+SnapshotWriter::SnapshotWriter(std::string directory) : directory(directory) {
+  node = CkMyNode();
+  stopping = false;
+  numLateStages = 0;
+  numBytesWritten = 0;
+  busySeconds = 0.0;
+  worker = std::thread(&SnapshotWriter::run, this);
+}
+
+SnapshotWriter::SnapshotWriter(CkMigrateMessage *m) : CBase_SnapshotWriter(m) {
+  node = CkMyNode();
+  stopping = false;
+  numLateStages = 0;
+  numBytesWritten = 0;
+  busySeconds = 0.0;
+}
+
+void SnapshotWriter::pup(PUP::er &p) {
+  CBase_SnapshotWriter::pup(p);
+  if(!p.isUnpacking())
+    waitUntilWritten();
+
+  p | directory;
+  p | numLateStages;
+  p | numBytesWritten;
+  p | busySeconds;
+
+  if(p.isUnpacking())
+    worker = std::thread(&SnapshotWriter::run, this);
+}
+
+SnapshotWriter::~SnapshotWriter() {
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    stopping = true;
+  }
+  changed.notify_all();
+  if(worker.joinable())
+    worker.join();
+  closeFiles(0);
+
+  for(size_t i=0; i<spares.size(); i++)
+    delete spares[i];
+}
+
+void SnapshotWriter::stage(int iter, int x, int y, const ParticleArray &particles) {
+  checkError();
+
+  SnapshotJob *job = NULL;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    // Both buffers of a cell are taken while snapshot iter - 2*snapshotFreq is still being
+    // written; the copy then goes to a new buffer instead of waiting for the thread
+    if(!numUnwritten.empty() && numUnwritten.begin()->first <= iter - 2*snapshotFreq)
+      numLateStages++;
+    if(!spares.empty()) {
+      job = spares.back();
+      spares.pop_back();
+    }
+  }
+  if(job == NULL)
+    job = new SnapshotJob;
+
+  int n = particles.size();
+  job->iter = iter;
+  job->data.resize(sizeof(SnapshotCellHeader) + n*sizeof(ParticleRecord));
+
+  SnapshotCellHeader *header = (SnapshotCellHeader *) job->data.data();
+  header->iter = iter;
+  header->cellX = x;
+  header->cellY = y;
+  header->count = n;
+
+  ParticleRecord *records = (ParticleRecord *) (header + 1);
+  for(int i=0; i<n; i++) {
+    records[i].x = particles.x[i];
+    records[i].y = particles.y[i];
+    records[i].gid = particles.gid[i];
+    records[i].color = particles.color[i];
+    records[i].pad[0] = records[i].pad[1] = records[i].pad[2] = 0;
+  }
+
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    queue.push(job);
+    numUnwritten[iter]++;
+  }
+  changed.notify_all();
+}
+
+void SnapshotWriter::waitUntilWritten() {
+  std::unique_lock<std::mutex> guard(lock);
+  changed.wait(guard, [&]() { return numUnwritten.empty(); });
+}
+
+// Abort on this PE with the error the thread ran into, if any
+void SnapshotWriter::checkError() {
+  std::lock_guard<std::mutex> guard(lock);
+  if(!error.empty())
+    CkAbort("%s", error.c_str());
+}
+
+void SnapshotWriter::retryFinish(void *writer, double now) {
+  ((SnapshotWriter *) writer)->finish();
+}
+
+void SnapshotWriter::finish() {
+  checkError();
+
+  double totals[3];
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    if(!numUnwritten.empty()) {
+      CcdCallFnAfter(retryFinish, this, FINISH_POLL_MS);
+      return;
+    }
+
+    // The thread is idle until the next stage(), so its counters can be read here
+    totals[0] = numBytesWritten;
+    totals[1] = busySeconds;
+    totals[2] = numLateStages;
+  }
+  CkCallback cb(CkIndex_Main::receiveSnapshotTotals(NULL), mainProxy);
+  contribute(3*sizeof(double), totals, CkReduction::sum_double, cb);
+}
+
+void SnapshotWriter::run() {
+  std::unique_lock<std::mutex> guard(lock);
+  while(true) {
+    changed.wait(guard, [&]() { return stopping || !queue.empty(); });
+    if(queue.empty())
+      return;
+
+    SnapshotJob *job = queue.front();
+    queue.pop();
+    // After an error the remaining jobs are dropped, so that the PEs waiting on them go on
+    bool failed = !error.empty();
+    guard.unlock();
+
+    std::string failure;
+    if(!failed) {
+      std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+      failed = !write(job, failure);
+      busySeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+    guard.lock();
+    if(!failure.empty() && error.empty())
+      error = failure;
+    if(--numUnwritten[job->iter] == 0)
+      numUnwritten.erase(job->iter);
+    spares.push_back(job);
+    changed.notify_all();
+  }
+}
+
+// Append a job to the file of its snapshot, or describe the error in failure
+bool SnapshotWriter::write(SnapshotJob *job, std::string &failure) {
+  std::map<int, int>::iterator file = files.find(job->iter);
+  if(file == files.end()) {
+    closeFiles(MAX_OPEN_SNAPSHOTS - 1);
+    std::string path = directory + "/snapshot_" + std::to_string(job->iter) + "_node" + std::to_string(node) + ".bin";
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if(fd < 0) {
+      failure = "Error while opening " + path + ": " + strerror(errno);
+      return false;
+    }
+    file = files.insert(std::make_pair(job->iter, fd)).first;
+  }
+
+  const char *buffer = job->data.data();
+  size_t numBytes = job->data.size();
+  while(numBytes > 0) {
+    ssize_t written = ::write(file->second, buffer, numBytes);
+    if(written < 0) {
+      if(errno == EINTR) continue;
+      failure = "Error while writing snapshot " + std::to_string(job->iter) + ": " + strerror(errno);
+      return false;
+    }
+    buffer += written;
+    numBytes -= written;
+  }
+  numBytesWritten += job->data.size();
+  return true;
+}
+
+// Close the oldest snapshot files until at most keep are open
+void SnapshotWriter::closeFiles(int keep) {
+  while((int) files.size() > keep) {
+    close(files.begin()->second);
+    files.erase(files.begin());
+  }
+}
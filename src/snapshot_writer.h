@@ -0,0 +1,92 @@
+#ifndef SNAPSHOT_WRITER_H
+#define SNAPSHOT_WRITER_H
+
+#include <chrono>
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <thread>
+#include <vector>
+#include "particle_array.h"
+#include "particle_output.h"
+
+#include "particleSimulation.decl.h"
+
+/*
+*Periodic trajectory snapshots (--snapshot-every N), written in the background.
+*Every N iterations each cell copies its particles into a staging buffer of its
+*process's writer and goes on with the next iteration. A thread owned by the
+*writer appends the buffers to <directory>/snapshot_<iter>_node<node>.bin.
+*
+*Staging never blocks the PE: a cell copies into a spare buffer, or a new one
+*when the thread is behind, and goes on. Two buffers per cell suffice while the
+*disk keeps up with one snapshot per N iterations; stages that find snapshot k-2
+*or older still unwritten are counted, as a sign that it does not. Buffers are
+*owned by the writer, so a cell may migrate with its snapshot still queued.
+*
+*The thread never calls into Converse, which does not support threads it did
+*not create: it uses the node number recorded on a PE and std::chrono, and an
+*I/O error is recorded for the next stage() or finish() to abort with on a PE.
+*
+*Each buffer is one SnapshotCellHeader followed by count ParticleRecords, in the
+*native byte order.
+*/
+
+struct SnapshotCellHeader {
+  int32_t iter;
+  int32_t cellX, cellY;
+  int32_t count;
+};
+
+struct SnapshotJob {
+  int iter;
+  std::vector<char> data;  // SnapshotCellHeader, then the records
+};
+
+class SnapshotWriter : public CBase_SnapshotWriter {
+  std::string directory;
+  int node;                            // recorded on a PE for the thread
+
+  std::mutex lock;
+  std::condition_variable changed;
+  std::queue<SnapshotJob *> queue;     // staged, not written yet
+  std::map<int, int> numUnwritten;     // staged or being written, per iteration
+  std::vector<SnapshotJob *> spares;   // written jobs, reused with their capacity
+  bool stopping;
+  std::string error;                   // first I/O error of the thread, empty if none
+  long numLateStages;                  // stages that found the thread two snapshots behind
+
+  // used by the thread only
+  std::map<int, int> files;            // open snapshot files, by iteration
+  long long numBytesWritten;
+  double busySeconds;
+
+  std::thread worker;
+
+  void run();
+  bool write(SnapshotJob *job, std::string &failure);
+  void closeFiles(int keep);
+  void waitUntilWritten();
+  void checkError();
+
+  static void retryFinish(void *writer, double now);
+
+  public:
+    SnapshotWriter(std::string directory);
+    SnapshotWriter(CkMigrateMessage *m);
+    ~SnapshotWriter();
+
+    // A checkpoint waits for the staged snapshots, and a restart starts a new thread
+    void pup(PUP::er &p);
+
+    // Copy the particles of cell (x, y) for iteration iter into a staging buffer
+    void stage(int iter, int x, int y, const ParticleArray &particles);
+
+    // Once every staged snapshot is written, report the totals to Main. The PE keeps
+    // scheduling meanwhile: finish() polls again later instead of waiting.
+    void finish();
+};
+
+#endif
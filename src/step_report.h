@@ -0,0 +1,48 @@
+#ifndef STEP_REPORT_H
+#define STEP_REPORT_H
+
+#include "phase_timers.h"
+
+/*
+*Payload of the stepReportType reduction, contributed by every cell each
+*reductionFreq iterations. One reduction carries everything Main tracks during
+*the run: 64-bit particle sums, the most and least loaded cells with their
+*coordinates, and the time spent in each phase since the previous reduction.
+*/
+struct StepReport {
+  long long total, outbound;
+  int iter;
+  int maxParticles, maxCellX, maxCellY;
+  int minParticles, minCellX, minCellY;
+  PhaseStat phases[NUM_PHASES];
+};
+
+// True if cell (x1, y1) comes before cell (x2, y2), used to break ties between equal counts
+inline bool cellBefore(int x1, int y1, int x2, int y2) {
+  return x1 < x2 || (x1 == x2 && y1 < y2);
+}
+
+// Reduce one contribution into another. Ties go to the lower cell index, so the
+// result does not depend on the order in which contributions arrive.
+inline void combineStepReports(StepReport &into, const StepReport &from) {
+  into.total += from.total;
+  into.outbound += from.outbound;
+
+  if(from.maxParticles > into.maxParticles ||
+     (from.maxParticles == into.maxParticles && cellBefore(from.maxCellX, from.maxCellY, into.maxCellX, into.maxCellY))) {
+    into.maxParticles = from.maxParticles;
+    into.maxCellX = from.maxCellX;
+    into.maxCellY = from.maxCellY;
+  }
+
+  if(from.minParticles < into.minParticles ||
+     (from.minParticles == into.minParticles && cellBefore(from.minCellX, from.minCellY, into.minCellX, into.minCellY))) {
+    into.minParticles = from.minParticles;
+    into.minCellX = from.minCellX;
+    into.minCellY = from.minCellY;
+  }
+
+  combinePhaseStats(into.phases, from.phases);
+}
+
+#endif
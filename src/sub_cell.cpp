@@ -0,0 +1,46 @@
+#include "sub_cell.h"
+#include "perturb_kernel.h"
+
+extern CProxy_Cell cellProxy;
+extern int velocityFactor;
+extern int perturbMode;
+extern bool particleLoad;
+
+SubCell::SubCell(double startX, double endX, double startY, double endY)
+  : startX(startX), endX(endX), startY(startY), endY(endY) {
+  usesAtSync = true;
+  usesAutoMeasure = !particleLoad;
+}
+
+void SubCell::step(int iter, ParticleArray &arrivals) {
+  particles.append(arrivals.gid.data(), arrivals.x.data(), arrivals.y.data(), arrivals.color.data(), arrivals.size());
+
+  perturbParticles(particles.x.data(), particles.y.data(), particles.color.data(), particles.size(), velocityFactor, perturbMode);
+
+  // Same swap-to-tail partition as Cell::updateParticles
+  ParticleArray leavers;
+  int numRemaining = particles.size();
+  int p = 0;
+  while(p < numRemaining) {
+    double x = particles.x[p], y = particles.y[p];
+    if(x >= startX && x <= endX && y >= startY && y <= endY) {
+      p++;
+      continue;
+    }
+    leavers.push_back(particles, p);
+    particles.copy(p, --numRemaining);
+  }
+  particles.resize(numRemaining);
+
+  cellProxy(thisIndex.x, thisIndex.y).childStepped(iter, thisIndex.z, numRemaining, leavers);
+}
+
+void SubCell::merge(int iter) {
+  cellProxy(thisIndex.x, thisIndex.y).childMerged(iter, particles);
+  particles.clear();
+}
+
+// Load balancing step of the parent: nothing is in flight to or from this child
+void SubCell::sync() {
+  AtSync();
+}
@@ -0,0 +1,56 @@
+#ifndef SUB_CELL_H
+#define SUB_CELL_H
+
+#include "particle_array.h"
+
+#include "particleSimulation.decl.h"
+
+// A refined cell is split into REFINE_SPLIT x REFINE_SPLIT children
+#define REFINE_SPLIT 2
+#define NUM_CHILDREN (REFINE_SPLIT * REFINE_SPLIT)
+
+/*
+*Child of a refined Cell, indexed by (cell x, cell y, child), owning the particles
+*of one sub-rectangle of the cell. Every iteration the parent sends the particles
+*that arrived in the sub-rectangle with step(). The child perturbs all of its
+*particles and returns the ones that left the sub-rectangle, and the parent routes
+*them to a sibling or to a neighbor cell. On merge() the child returns everything
+*and stays dormant until the parent refines again.
+*
+*Neighbor cells only know the parent, so a particle crossing into a refined cell
+*is relayed by the parent to its child, and a leaver goes back through the parent:
+*two extra messages per child per step, one in each direction. Neighbors and the
+*exchange protocol stay unaware of refinement, and ParticleLB places the children
+*on the PE of their parent, so the relay stays within the process.
+*
+*Children take part in AtSync load balancing: the parent calls sync() on every
+*child it created, active or dormant, before its own AtSync(). They are pupped
+*with the rest of the program at a checkpoint, where nothing is in flight to them.
+*/
+
+class SubCell : public CBase_SubCell {
+  double startX, endX, startY, endY;
+  ParticleArray particles;
+
+  public:
+    SubCell(double startX, double endX, double startY, double endY);
+    SubCell(CkMigrateMessage *m) : CBase_SubCell(m) {}
+
+    void step(int iter, ParticleArray &arrivals);
+    void merge(int iter);
+    void sync();
+
+    // With --particle-load the load balancer sees the particle count instead of the measured time
+    void UserSetLBLoad() { setObjTime(particles.size()); }
+
+    void pup(PUP::er &p) {
+      CBase_SubCell::pup(p);
+      p | startX;
+      p | endX;
+      p | startY;
+      p | endY;
+      p | particles;
+    }
+};
+
+#endif
@@ -0,0 +1,165 @@
+/*
+*Checks of the runtime-free kernels, built like the microbenchmarks without the
+*Charm++ runtime (make unittest). Prints every failed check and exits non-zero
+*if there was one.
+*
+*usage: ./kernel_test
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <algorithm>
+
+#include "pup_stl.h"
+#include "particle.h"
+#include "particle_array.h"
+#include "particle_kernels.h"
+#include "particle_codec.h"
+
+static int numFailures = 0;
+
+#define CHECK(cond, ...) do { \
+    if(!(cond)) { \
+      printf("FAILED %s:%d: %s: ", __FILE__, __LINE__, #cond); \
+      printf(__VA_ARGS__); \
+      printf("\n"); \
+      numFailures++; \
+    } \
+  } while(0)
+
+// A particle starting on either edge of a cell and moving the maximum distance on
+// every step must end inside the exchange window of that cell
+static void testExchangeWindowEdges() {
+  const int numCellsPerDim = 1000;
+  const int cell = 500;
+  const double cellDims[] = { 1.0, 0.5, 0.3 };
+
+  for(int d=0; d<3; d++) {
+    double cellDim = cellDims[d];
+    double startX = cell*cellDim, endX = (cell + 1)*cellDim;
+
+    for(int velocityFactor=1; velocityFactor<=10; velocityFactor++) {
+      for(int steps=2; steps<=20; steps++) {
+        int radius = exchangeWindowRadius(steps, velocityFactor, cellDim);
+
+        // accumulate the steps one at a time, as the perturb kernel does
+        double right = endX, left = startX;
+        for(int s=0; s<steps; s++) {
+          right += 1.0/velocityFactor;
+          left -= 1.0/velocityFactor;
+        }
+
+        int rightOffset = cellOfCoordinate(right, cellDim, numCellsPerDim) - cell;
+        int leftOffset = cellOfCoordinate(left, cellDim, numCellsPerDim) - cell;
+        CHECK(rightOffset <= radius, "cellDim %g, velocityFactor %d, %d steps: from endX %d cells away, radius %d",
+              cellDim, velocityFactor, steps, rightOffset, radius);
+        CHECK(-leftOffset <= radius, "cellDim %g, velocityFactor %d, %d steps: from startX %d cells away, radius %d",
+              cellDim, velocityFactor, steps, -leftOffset, radius);
+      }
+    }
+  }
+}
+
+// Buckets hold every particle once, under the cell owning its gid, with the remainder of
+// the gids going to the last cell
+static void testBucketByOwner() {
+  const int numCells = 7, ppcEqualDist = 10;
+  const int numParticles = numCells*ppcEqualDist + 4;
+
+  // gids 21 to the last one, out of order
+  ParticleArray particles;
+  int numGids = numParticles - 20;
+  for(int i=0; i<numGids; i++) {
+    int gid = 21 + (i*17) % numGids;
+    particles.push_back(Particle(gid*0.5, gid*0.25, 'r', gid));
+  }
+
+  std::vector<int> owners;
+  std::vector<ParticleArray> buckets;
+  bucketByOwner(particles, ppcEqualDist, numCells, owners, buckets);
+
+  CHECK(owners.size() == buckets.size(), "%d owners, %d buckets", (int) owners.size(), (int) buckets.size());
+  int total = 0;
+  for(int b=0; b<owners.size(); b++) {
+    CHECK(b == 0 || owners[b] > owners[b-1], "owner %d after %d", owners[b], b == 0 ? -1 : owners[b-1]);
+    CHECK(buckets[b].size() > 0, "empty bucket for owner %d", owners[b]);
+    for(int k=0; k<buckets[b].size(); k++) {
+      int gid = buckets[b].gid[k];
+      int owner = std::min((gid - 1)/ppcEqualDist, numCells - 1);
+      CHECK(owner == owners[b], "gid %d in the bucket of %d", gid, owners[b]);
+      CHECK(buckets[b].x[k] == gid*0.5 && buckets[b].y[k] == gid*0.25, "gid %d lost its position", gid);
+    }
+    total += buckets[b].size();
+  }
+  CHECK(total == particles.size(), "%d particles bucketed out of %d", total, particles.size());
+
+  ParticleArray none;
+  bucketByOwner(none, ppcEqualDist, numCells, owners, buckets);
+  CHECK(owners.empty() && buckets.empty(), "%d owners for no particles", (int) owners.size());
+}
+
+// Encode a batch of particles of cell (3, 4) and decode it again
+static ParticleArray roundTrip(const ParticleCodec &codec, const ParticleArray &batch) {
+  std::vector<char> buffer(codec.maxEncodedSize(batch.size()));
+  std::vector<int> order;
+  int numBytes = codec.encode(batch, 3.0, 4.0, buffer.data(), order);
+  CHECK(numBytes <= (int) buffer.size(), "%d bytes encoded, at most %d expected", numBytes, (int) buffer.size());
+
+  ParticleArray decoded;
+  codec.decode(buffer.data(), decoded);
+  return decoded;
+}
+
+// Quantized coordinates stay within the bound and a bound too fine to quantize sends
+// them exactly
+static void testParticleCodec() {
+  ParticleArray batch;
+  for(int i=0; i<100; i++)
+    batch.push_back(Particle(3.0 + (i*0.618034) - (int) (i*0.618034), 4.0 + i/100.0, "rgb"[i % 3], 1000 - 7*i));
+
+  const double bounds[] = { 1e-3, 1e-7, 1e-11, 1e-13 };
+  for(int b=0; b<4; b++) {
+    ParticleCodec codec(1.0, bounds[b]);
+    ParticleArray decoded = roundTrip(codec, batch);
+    CHECK(decoded.size() == batch.size(), "%d particles decoded out of %d", decoded.size(), batch.size());
+
+    // decoded particles come out sorted by gid, the reverse of batch
+    for(int i=0; i<decoded.size(); i++) {
+      int k = batch.size() - 1 - i;
+      CHECK(decoded.gid[i] == batch.gid[k] && decoded.color[i] == batch.color[k], "bound %g: particle %d changed", bounds[b], k);
+      double error = std::max(fabs(decoded.x[i] - batch.x[k]), fabs(decoded.y[i] - batch.y[k]));
+      CHECK(error <= bounds[b], "bound %g: particle %d off by %g", bounds[b], k, error);
+      if(codec.exactPositions())
+        CHECK(error == 0, "bound %g: exact particle %d off by %g", bounds[b], k, error);
+    }
+  }
+  CHECK(!ParticleCodec(1.0, 1e-7).exactPositions(), "1e-7 sent exact");
+  CHECK(ParticleCodec(1.0, 1e-13).exactPositions(), "1e-13 quantized");
+
+  // the 1000 exchanges of make testbench leave room for quantization
+  CHECK(migrationErrorBound(1e-6, 1000) * 1000 <= 1e-6, "bound %g over 1000 migrations", migrationErrorBound(1e-6, 1000));
+  CHECK(!ParticleCodec(1.0, migrationErrorBound(1e-6, 1000)).exactPositions(), "1000 migrations sent exact");
+}
+
+static void testCellOfCoordinate() {
+  CHECK(cellOfCoordinate(0.0, 1.0, 10) == 0, "got %d", cellOfCoordinate(0.0, 1.0, 10));
+  CHECK(cellOfCoordinate(3.0, 1.0, 10) == 3, "got %d", cellOfCoordinate(3.0, 1.0, 10));
+  CHECK(cellOfCoordinate(3.999, 1.0, 10) == 3, "got %d", cellOfCoordinate(3.999, 1.0, 10));
+  CHECK(cellOfCoordinate(-1e-9, 1.0, 10) == 0, "got %d", cellOfCoordinate(-1e-9, 1.0, 10));
+  CHECK(cellOfCoordinate(10.0, 1.0, 10) == 9, "got %d", cellOfCoordinate(10.0, 1.0, 10));
+}
+
+int main(int argc, char **argv) {
+  testCellOfCoordinate();
+  testExchangeWindowEdges();
+  testBucketByOwner();
+  testParticleCodec();
+
+  if(numFailures > 0) {
+    printf("%d checks failed\n", numFailures);
+    return 1;
+  }
+  printf("All checks passed\n");
+  return 0;
+}